@@ -0,0 +1,277 @@
+#ifndef BRICK_POOL_H
+#define BRICK_POOL_H
+
+#include <openvdb/openvdb.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// How a brick pool stores voxel values
+enum class BrickEncoding {
+    Half,   // IEEE half floats
+    UInt16, // 16-bit codes with a per-brick scale and offset
+    UInt8   // 8-bit codes with a per-brick scale and offset
+};
+
+// Dense copy of the active region of a float grid for the march to read
+// without tree descents. Every leaf and every leaf-sized block of an
+// active tile becomes an 8^3 brick, stored at reduced precision with a
+// one-voxel apron so a trilinear stencil never leaves its brick. Empty
+// blocks on the low side of a brick get an apron-only brick as well, since
+// a stencil starting there reaches into the brick and, once releaseLeaves()
+// has run, the tree only holds the leaf maximum at those voxels. Bricks sit
+// in one pool in Morton order of their position, so bricks that are close
+// in space are close in memory, and a flat table over the brick bounding
+// box maps a brick position to its slot in a single load.
+//
+// Integer codes map a brick's value range, apron included, linearly onto
+// [0, 2^bits - 1]. Density starts at 0 in nearly every brick, so empty
+// voxels decode to exactly 0 and the range maximum decodes to itself.
+class BrickPool {
+public:
+    using Value = openvdb::math::half;
+    
+    // One brick's stored values and the affine map decoding its codes
+    struct Brick {
+        const void* values = nullptr;
+        float scale = 1.0f;
+        float offset = 0.0f;
+    };
+    
+    static constexpr int Log2Dim = 3;
+    static constexpr int Dim = 1 << Log2Dim;           // Brick edge in voxels, the size of a VDB leaf
+    static constexpr int Stride = Dim + 2;             // Stored edge, apron included
+    static constexpr int BrickValues = Stride * Stride * Stride;
+    static constexpr uint32_t Empty = std::numeric_limits<uint32_t>::max();
+    
+    explicit BrickPool(const openvdb::FloatGrid& grid, BrickEncoding encoding = BrickEncoding::Half)
+        : encoding(encoding) {
+        std::vector<openvdb::Coord> bricks = collectBricks(grid);
+        if (bricks.empty()) return;
+        
+        tableMin = bricks.front();
+        openvdb::Coord tableMax = bricks.front();
+        for (const openvdb::Coord& b : bricks) {
+            tableMin = openvdb::Coord::minComponent(tableMin, b);
+            tableMax = openvdb::Coord::maxComponent(tableMax, b);
+        }
+        tableDims = tableMax - tableMin + openvdb::Coord(1);
+        
+        // Morton order of the brick positions relative to the table corner
+        std::vector<std::pair<uint64_t, openvdb::Coord>> order;
+        order.reserve(bricks.size());
+        for (const openvdb::Coord& b : bricks) {
+            openvdb::Coord local = b - tableMin;
+            order.emplace_back(morton(local.x(), local.y(), local.z()), b);
+        }
+        std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        
+        table.assign(static_cast<size_t>(tableDims.x()) * tableDims.y() * tableDims.z(), Empty);
+        for (size_t n = 0; n < order.size(); ++n) {
+            table[tableIndex(order[n].second - tableMin)] = static_cast<uint32_t>(n);
+        }
+        
+        // Bake each brick, apron included, through its own accessor
+        const size_t count = order.size() * BrickValues;
+        switch (encoding) {
+            case BrickEncoding::Half: halfValues.resize(count); break;
+            case BrickEncoding::UInt16: codes16.resize(count); break;
+            case BrickEncoding::UInt8: codes8.resize(count); break;
+        }
+        brickMax.resize(order.size());
+        brickScale.resize(order.size(), 1.0f);
+        brickOffset.resize(order.size(), 0.0f);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, order.size()), [&](const tbb::blocked_range<size_t>& range) {
+            openvdb::FloatGrid::ConstAccessor accessor = grid.getConstAccessor();
+            float voxels[BrickValues];
+            for (size_t n = range.begin(); n != range.end(); ++n) {
+                const openvdb::Coord origin = order[n].second << Log2Dim;
+                float maxValue = std::numeric_limits<float>::lowest();
+                for (int x = -1; x <= Dim; ++x) {
+                    for (int y = -1; y <= Dim; ++y) {
+                        for (int z = -1; z <= Dim; ++z) {
+                            float value = accessor.getValue(origin.offsetBy(x, y, z));
+                            voxels[offset(x, y, z)] = value;
+                            if (x >= 0 && y >= 0 && z >= 0 && x < Dim && y < Dim && z < Dim) {
+                                maxValue = std::max(maxValue, value);
+                            }
+                        }
+                    }
+                }
+                brickMax[n] = maxValue;
+                store(n, voxels);
+            }
+        });
+    }
+    
+    // Replace every leaf of `grid` with an active tile holding the leaf's
+    // maximum. The active topology keeps its leaf granularity and bounds the
+    // values as before, but the voxel buffers are freed, so a pool baked from
+    // the grid beforehand becomes the only copy of the voxel values.
+    static void releaseLeaves(openvdb::FloatGrid& grid) {
+        std::vector<std::pair<openvdb::Coord, float>> tiles;
+        for (auto leaf = grid.tree().cbeginLeaf(); leaf; ++leaf) {
+            float maxValue = std::numeric_limits<float>::lowest();
+            for (auto iter = leaf->cbeginValueAll(); iter; ++iter) {
+                maxValue = std::max(maxValue, *iter);
+            }
+            tiles.emplace_back(leaf->origin(), maxValue);
+        }
+        for (const auto& [origin, maxValue] : tiles) {
+            grid.tree().addTile(1, origin, maxValue, true);
+        }
+    }
+    
+    // Slot of the brick holding index-space voxel ijk, or Empty
+    uint32_t find(const openvdb::Coord& ijk) const {
+        if (table.empty()) return Empty;
+        openvdb::Coord b = (ijk >> Log2Dim) - tableMin;
+        if (static_cast<uint32_t>(b.x()) >= static_cast<uint32_t>(tableDims.x()) ||
+            static_cast<uint32_t>(b.y()) >= static_cast<uint32_t>(tableDims.y()) ||
+            static_cast<uint32_t>(b.z()) >= static_cast<uint32_t>(tableDims.z())) {
+            return Empty;
+        }
+        return table[tableIndex(b)];
+    }
+    
+    // Stored values of a brick, x-major like a VDB leaf buffer; voxel
+    // (x, y, z) of the brick, -1 to Dim on each axis, is at offset(x, y, z)
+    Brick brick(uint32_t slot) const {
+        const size_t first = static_cast<size_t>(slot) * BrickValues;
+        switch (encoding) {
+            case BrickEncoding::Half: return {halfValues.data() + first};
+            case BrickEncoding::UInt16: return {codes16.data() + first, brickScale[slot], brickOffset[slot]};
+            case BrickEncoding::UInt8: return {codes8.data() + first, brickScale[slot], brickOffset[slot]};
+        }
+        return {};
+    }
+    
+    // Value `i` of a brick
+    float decode(const Brick& b, int i) const {
+        switch (encoding) {
+            case BrickEncoding::Half: return static_cast<const Value*>(b.values)[i];
+            case BrickEncoding::UInt16: return b.offset + b.scale * static_cast<const uint16_t*>(b.values)[i];
+            case BrickEncoding::UInt8: return b.offset + b.scale * static_cast<const uint8_t*>(b.values)[i];
+        }
+        return 0.0f;
+    }
+    
+    BrickEncoding getEncoding() const { return encoding; }
+    
+    // Maximum over the brick's own voxels, before quantization
+    float maxValue(uint32_t slot) const { return brickMax[slot]; }
+    
+    static constexpr int offset(int x, int y, int z) {
+        return ((x + 1) * Stride + (y + 1)) * Stride + (z + 1);
+    }
+    
+    size_t brickCount() const { return brickMax.size(); }
+    
+    size_t memUsage() const {
+        return halfValues.size() * sizeof(Value) + codes16.size() * sizeof(uint16_t) + codes8.size() +
+               3 * brickMax.size() * sizeof(float) + table.size() * sizeof(uint32_t);
+    }
+    
+private:
+    BrickEncoding encoding;
+    openvdb::Coord tableMin;
+    openvdb::Coord tableDims;
+    std::vector<uint32_t> table;
+    
+    // Values of every brick in the storage of the encoding, and per brick
+    // the maximum of its own voxels and the code scale and offset
+    std::vector<Value> halfValues;
+    std::vector<uint16_t> codes16;
+    std::vector<uint8_t> codes8;
+    std::vector<float> brickMax;
+    std::vector<float> brickScale;
+    std::vector<float> brickOffset;
+    
+    // Encode the BrickValues floats of brick `n`
+    void store(size_t n, const float* voxels) {
+        const size_t first = n * BrickValues;
+        if (encoding == BrickEncoding::Half) {
+            for (int i = 0; i < BrickValues; ++i) {
+                halfValues[first + i] = Value(voxels[i]);
+            }
+            return;
+        }
+        
+        const float maxCode = encoding == BrickEncoding::UInt16 ? 65535.0f : 255.0f;
+        auto [lo, hi] = std::minmax_element(voxels, voxels + BrickValues);
+        float scale = *hi > *lo ? (*hi - *lo) / maxCode : 1.0f;
+        brickScale[n] = scale;
+        brickOffset[n] = *lo;
+        for (int i = 0; i < BrickValues; ++i) {
+            float code = std::min(std::round((voxels[i] - *lo) / scale), maxCode);
+            if (encoding == BrickEncoding::UInt16) {
+                codes16[first + i] = static_cast<uint16_t>(code);
+            } else {
+                codes8[first + i] = static_cast<uint8_t>(code);
+            }
+        }
+    }
+    
+    // Table entry of a brick position relative to tableMin
+    size_t tableIndex(const openvdb::Coord& b) const {
+        return (static_cast<size_t>(b.x()) * tableDims.y() + b.y()) * tableDims.z() + b.z();
+    }
+    
+    // Interleave the low 21 bits of x, y and z
+    static uint64_t morton(uint32_t x, uint32_t y, uint32_t z) {
+        auto spread = [](uint64_t v) {
+            v &= 0x1fffff;
+            v = (v | v << 32) & 0x1f00000000ffffULL;
+            v = (v | v << 16) & 0x1f0000ff0000ffULL;
+            v = (v | v << 8) & 0x100f00f00f00f00fULL;
+            v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+            v = (v | v << 2) & 0x1249249249249249ULL;
+            return v;
+        };
+        return spread(x) << 2 | spread(y) << 1 | spread(z);
+    }
+    
+    // Brick positions (voxel >> Log2Dim) of every leaf, of every leaf-sized
+    // block inside an active tile and of the empty blocks whose trilinear
+    // stencils reach into one of those
+    static std::vector<openvdb::Coord> collectBricks(const openvdb::FloatGrid& grid) {
+        std::vector<openvdb::Coord> bricks;
+        for (auto leaf = grid.tree().cbeginLeaf(); leaf; ++leaf) {
+            bricks.push_back(leaf->origin() >> Log2Dim);
+        }
+        
+        auto tileIter = grid.tree().cbeginValueOn();
+        tileIter.setMaxDepth(openvdb::FloatTree::ValueOnCIter::LEAF_DEPTH - 1);
+        for (; tileIter; ++tileIter) {
+            openvdb::CoordBBox bbox;
+            tileIter.getBoundingBox(bbox);
+            openvdb::Coord lo = bbox.min() >> Log2Dim, hi = bbox.max() >> Log2Dim;
+            for (int x = lo.x(); x <= hi.x(); ++x) {
+                for (int y = lo.y(); y <= hi.y(); ++y) {
+                    for (int z = lo.z(); z <= hi.z(); ++z) {
+                        bricks.emplace_back(x, y, z);
+                    }
+                }
+            }
+        }
+        
+        // A stencil from block b reads blocks b to b + 1 on each axis
+        const size_t filled = bricks.size();
+        bricks.reserve(filled * 8);
+        for (size_t n = 0; n < filled; ++n) {
+            for (int d = 1; d < 8; ++d) {
+                bricks.push_back(bricks[n].offsetBy(-(d >> 2 & 1), -(d >> 1 & 1), -(d & 1)));
+            }
+        }
+        std::sort(bricks.begin(), bricks.end());
+        bricks.erase(std::unique(bricks.begin(), bricks.end()), bricks.end());
+        return bricks;
+    }
+};
+
+#endif // BRICK_POOL_H
@@ -1,150 +1,241 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
-#include "Eigen/Dense"
+#include "VecMath.h"
+#include <array>
 #include <cmath>
+#include <limits>
+#include <vector>
+
+// Pinhole camera shared by both renderers, templated on the scalar type.
+// Image coordinates u and v run over [0, 1], left to right and bottom to top.
+template <typename T>
+class CameraT {
+public:
+    using Vec3 = Vec3T<T>;
+    using Ray = RayT<T>;
 
-class Camera {
 private:
-    Eigen::Vector3d position;    // Camera position in world space
-    Eigen::Vector3d lookAt;      // Point the camera is looking at
-    Eigen::Vector3d up;          // Up vector
-    double fov;                  // Field of view in degrees
-    double aspectRatio;          // Width/height ratio
-    double nearPlane;            // Near clipping plane
-    double farPlane;             // Far clipping plane
+    Vec3 position;               // Camera position in world space
+    Vec3 lookAt;                 // Point the camera is looking at
+    Vec3 up;                     // Up vector
+    T fov;                       // Field of view in degrees
+    T aspectRatio;               // Width/height ratio
+    T nearPlane;                 // Near clipping plane
+    T farPlane;                  // Far clipping plane
 
     // Derived vectors
-    Eigen::Vector3d forward;     // Forward direction vector
-    Eigen::Vector3d right;       // Right direction vector
-    Eigen::Vector3d upVector;    // Up direction vector
+    Vec3 forward;                // Forward direction vector
+    Vec3 right;                  // Right direction vector
+    Vec3 upVector;               // Up direction vector
+
+    // Viewport extent at unit distance, cached so ray generation is tan-free
+    T viewportWidth;
+    T viewportHeight;
+
+    void updateViewport() {
+        T fovRad = fov * static_cast<T>(M_PI) / T(180);
+        viewportHeight = T(2) * std::tan(fovRad / T(2));
+        viewportWidth = viewportHeight * aspectRatio;
+    }
 
     void updateVectors() {
         // Calculate forward vector
         forward = (lookAt - position).normalized();
-        
+
         // Calculate right vector
         right = forward.cross(up).normalized();
-        
+
         // Recalculate up vector to ensure orthogonality
         upVector = right.cross(forward).normalized();
     }
 
 public:
     // Constructor
-    Camera(const Eigen::Vector3d& pos = Eigen::Vector3d(0, 0, 0),
-           const Eigen::Vector3d& target = Eigen::Vector3d(0, 0, -1),
-           const Eigen::Vector3d& upDir = Eigen::Vector3d(0, 1, 0),
-           double fieldOfView = 60.0,
-           double ratio = 16.0/9.0,
-           double near = 0.1,
-           double far = 1000.0)
+    CameraT(const Vec3& pos = Vec3(0, 0, 0),
+            const Vec3& target = Vec3(0, 0, -1),
+            const Vec3& upDir = Vec3(0, 1, 0),
+            T fieldOfView = 60,
+            T ratio = T(16) / T(9),
+            T near = T(0.1),
+            T far = 1000)
         : position(pos), lookAt(target), up(upDir),
           fov(fieldOfView), aspectRatio(ratio),
           nearPlane(near), farPlane(far) {
         updateVectors();
+        updateViewport();
     }
 
     // Getters
-    const Eigen::Vector3d& getPosition() const { return position; }
-    const Eigen::Vector3d& getLookAt() const { return lookAt; }
-    const Eigen::Vector3d& getUp() const { return up; }
-    const Eigen::Vector3d& getForward() const { return forward; }
-    const Eigen::Vector3d& getRight() const { return right; }
-    const Eigen::Vector3d& getUpVector() const { return upVector; }
-    double getFOV() const { return fov; }
-    double getAspectRatio() const { return aspectRatio; }
-    double getNearPlane() const { return nearPlane; }
-    double getFarPlane() const { return farPlane; }
+    const Vec3& getPosition() const { return position; }
+    const Vec3& getLookAt() const { return lookAt; }
+    const Vec3& getUp() const { return up; }
+    const Vec3& getForward() const { return forward; }
+    const Vec3& getRight() const { return right; }
+    const Vec3& getUpVector() const { return upVector; }
+    T getFOV() const { return fov; }
+    T getAspectRatio() const { return aspectRatio; }
+    T getNearPlane() const { return nearPlane; }
+    T getFarPlane() const { return farPlane; }
+    T getViewportWidth() const { return viewportWidth; }
+    T getViewportHeight() const { return viewportHeight; }
 
     // Setters
-    void setPosition(const Eigen::Vector3d& pos) {
+    void setPosition(const Vec3& pos) {
         position = pos;
         updateVectors();
     }
 
-    void setLookAt(const Eigen::Vector3d& target) {
+    void setLookAt(const Vec3& target) {
         lookAt = target;
         updateVectors();
     }
 
-    void setUp(const Eigen::Vector3d& upDir) {
+    void setUp(const Vec3& upDir) {
         up = upDir;
         updateVectors();
     }
 
-    void setFOV(double fieldOfView) {
+    void setFOV(T fieldOfView) {
         fov = fieldOfView;
+        updateViewport();
     }
 
-    void setAspectRatio(double ratio) {
+    void setAspectRatio(T ratio) {
         aspectRatio = ratio;
+        updateViewport();
     }
 
-    void setNearPlane(double near) {
+    void setNearPlane(T near) {
         nearPlane = near;
     }
 
-    void setFarPlane(double far) {
+    void setFarPlane(T far) {
         farPlane = far;
     }
 
-    // Generate a ray from camera position through a pixel
-    Eigen::Vector3d generateRay(double u, double v) const {
-        // Convert FOV to radians
-        double fovRad = fov * M_PI / 180.0;
-        
-        // Calculate viewport dimensions
-        double viewportHeight = 2.0 * tan(fovRad / 2.0);
-        double viewportWidth = viewportHeight * aspectRatio;
-        
+    // Unit direction of the ray from the camera position through (u, v)
+    [[nodiscard]] Vec3 generateRay(T u, T v) const {
         // Calculate pixel position in viewport space
-        double pixelX = (u - 0.5) * viewportWidth;
-        double pixelY = (v - 0.5) * viewportHeight;
-        
+        T pixelX = (u - T(0.5)) * viewportWidth;
+        T pixelY = (v - T(0.5)) * viewportHeight;
+
         // Calculate ray direction
-        Eigen::Vector3d rayDir = forward + 
-                                right * pixelX + 
-                                upVector * pixelY;
-        
+        Vec3 rayDir = forward +
+                      right * pixelX +
+                      upVector * pixelY;
+
         return rayDir.normalized();
     }
 
-    // Get view matrix (for use in shaders or other transformations)
-    Eigen::Matrix4d getViewMatrix() const {
-        Eigen::Matrix4d view = Eigen::Matrix4d::Identity();
-        
-        // Calculate the basis vectors
-        Eigen::Vector3d z = -forward;
-        Eigen::Vector3d x = right;
-        Eigen::Vector3d y = upVector;
-        
-        // Set the rotation part of the view matrix
-        view.block<1,3>(0,0) = x.transpose();
-        view.block<1,3>(1,0) = y.transpose();
-        view.block<1,3>(2,0) = z.transpose();
-        
-        // Set the translation part
-        view.block<3,1>(0,3) = -position;
-        
-        return view;
-    }
-
-    // Get projection matrix (for use in shaders or other transformations)
-    Eigen::Matrix4d getProjectionMatrix() const {
-        Eigen::Matrix4d projection = Eigen::Matrix4d::Zero();
-        
-        double fovRad = fov * M_PI / 180.0;
-        double tanHalfFov = tan(fovRad / 2.0);
-        
-        projection(0,0) = 1.0 / (aspectRatio * tanHalfFov);
-        projection(1,1) = 1.0 / tanHalfFov;
-        projection(2,2) = -(farPlane + nearPlane) / (farPlane - nearPlane);
-        projection(2,3) = -2.0 * farPlane * nearPlane / (farPlane - nearPlane);
-        projection(3,2) = -1.0;
-        
+    // Ray from the camera position through (u, v)
+    [[nodiscard]] Ray getRay(T u, T v) const {
+        return Ray(position, generateRay(u, v));
+    }
+
+    // Generate the ray directions of pixels x0 to x0 + count - 1 of a
+    // scanline at v, with u = x / width. Each is generateRay()'s exact
+    // formula with the row's vertical term hoisted, so rows match per-pixel
+    // rays bit for bit and no rounding builds up along the row.
+    void generateRow(int x0, int count, int width, T v, Vec3* rayDirs) const {
+        const Vec3 vertical = upVector * ((v - T(0.5)) * viewportHeight);
+
+        for (int i = 0; i < count; ++i) {
+            T u = static_cast<T>(x0 + i) / width;
+            rayDirs[i] = (forward + right * ((u - T(0.5)) * viewportWidth) + vertical).normalized();
+        }
+    }
+
+    // World-space height of one pixel at unit distance, for `height` rows
+    [[nodiscard]] T footprintPerDistance(int height) const {
+        return viewportHeight / height;
+    }
+
+    // Bounding box of the part of [boxMin, boxMax] inside the view frustum,
+    // or inside the sub-frustum of the image window [u0, u1] x [v0, v1]:
+    // each box face is clipped against the near and four side planes and
+    // the surviving vertices are bounded. False if none of the box is visible.
+    bool clipBox(const Vec3& boxMin, const Vec3& boxMax, Vec3& clipMin, Vec3& clipMax,
+                 T u0 = 0, T v0 = 0, T u1 = 1, T v1 = 1) const {
+        // Inward plane normals through the camera position, oriented by the
+        // ray through the window centre
+        const Vec3 left = forward + right * ((u0 - T(0.5)) * viewportWidth);
+        const Vec3 rightEdge = forward + right * ((u1 - T(0.5)) * viewportWidth);
+        const Vec3 bottom = forward + upVector * ((v0 - T(0.5)) * viewportHeight);
+        const Vec3 top = forward + upVector * ((v1 - T(0.5)) * viewportHeight);
+        const Vec3 centre = generateRay((u0 + u1) / T(2), (v0 + v1) / T(2));
+        Vec3 normals[5] = {forward, left.cross(upVector), rightEdge.cross(upVector), bottom.cross(right), top.cross(right)};
+        for (Vec3& n : normals) {
+            if (n.dot(centre) < T(0)) n = -n;
+        }
+
+        Vec3 corners[8];
+        for (int i = 0; i < 8; ++i) {
+            corners[i] = Vec3(i & 1 ? boxMax.x : boxMin.x, i & 2 ? boxMax.y : boxMin.y, i & 4 ? boxMax.z : boxMin.z);
+        }
+        const int faces[6][4] = {{0, 2, 6, 4}, {1, 3, 7, 5}, {0, 1, 5, 4}, {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 5, 7, 6}};
+
+        bool visible = false;
+        clipMin = Vec3(std::numeric_limits<T>::max());
+        clipMax = Vec3(std::numeric_limits<T>::lowest());
+        std::vector<Vec3> polygon, clipped;
+        for (const auto& face : faces) {
+            polygon.assign({corners[face[0]], corners[face[1]], corners[face[2]], corners[face[3]]});
+
+            // Sutherland-Hodgman against each plane in turn
+            for (const Vec3& n : normals) {
+                clipped.clear();
+                for (size_t i = 0; i < polygon.size(); ++i) {
+                    const Vec3& a = polygon[i];
+                    const Vec3& b = polygon[(i + 1) % polygon.size()];
+                    T da = (a - position).dot(n), db = (b - position).dot(n);
+                    if (da >= T(0)) clipped.push_back(a);
+                    if ((da >= T(0)) != (db >= T(0))) {
+                        clipped.push_back(a + (b - a) * (da / (da - db)));
+                    }
+                }
+                polygon.swap(clipped);
+                if (polygon.empty()) break;
+            }
+
+            for (const Vec3& p : polygon) {
+                clipMin = Vec3::min(clipMin, p);
+                clipMax = Vec3::max(clipMax, p);
+                visible = true;
+            }
+        }
+
+        // The frustum apex is the one vertex not on a box face
+        if (position.x >= boxMin.x && position.y >= boxMin.y && position.z >= boxMin.z &&
+            position.x <= boxMax.x && position.y <= boxMax.y && position.z <= boxMax.z) {
+            clipMin = Vec3::min(clipMin, position);
+            clipMax = Vec3::max(clipMax, position);
+            visible = true;
+        }
+        return visible;
+    }
+
+    // Get view matrix, row-major (for use in shaders or other transformations)
+    [[nodiscard]] std::array<T, 16> getViewMatrix() const {
+        // Rows are the camera basis; z points backward
+        const Vec3 z = -forward;
+        return {right.x,    right.y,    right.z,    -position.x,
+                upVector.x, upVector.y, upVector.z, -position.y,
+                z.x,        z.y,        z.z,        -position.z,
+                T(0),       T(0),       T(0),       T(1)};
+    }
+
+    // Get projection matrix, row-major (for use in shaders or other transformations)
+    [[nodiscard]] std::array<T, 16> getProjectionMatrix() const {
+        T tanHalfFov = viewportHeight / T(2);
+        std::array<T, 16> projection{};
+        projection[0] = T(1) / (aspectRatio * tanHalfFov);
+        projection[5] = T(1) / tanHalfFov;
+        projection[10] = -(farPlane + nearPlane) / (farPlane - nearPlane);
+        projection[11] = T(-2) * farPlane * nearPlane / (farPlane - nearPlane);
+        projection[14] = T(-1);
         return projection;
     }
 };
 
-#endif // CAMERA_H 
\ No newline at end of file
+#endif // CAMERA_H
@@ -0,0 +1,185 @@
+#include "GpuMarch.h"
+
+#include <nanovdb/NanoVDB.h>
+#include <cuda_runtime.h>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+// Device copy of a NanoVDB grid buffer
+struct GpuGrid {
+    void* data = nullptr;
+    size_t bytes = 0;
+};
+
+namespace {
+
+using DensityGrid = nanovdb::NanoGrid<float>;
+
+__device__ inline float3 operator+(float3 a, float3 b) { return make_float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+__device__ inline float3 operator*(float3 a, float s) { return make_float3(a.x * s, a.y * s, a.z * s); }
+__device__ inline float dot(float3 a, float3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+__device__ inline float3 load(const float* v) { return make_float3(v[0], v[1], v[2]); }
+
+// Same rounding as Vec3T::normalized()
+__device__ inline float3 normalized(float3 v) { return v * (1.0f / sqrtf(dot(v, v))); }
+
+// Map a world point (w = 1) or direction (w = 0) into index space
+__device__ inline float3 toIndex(const float* m, float3 p, float w) {
+    return make_float3(m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3] * w,
+                       m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7] * w,
+                       m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11] * w);
+}
+
+// VolumeRenderer::intersectBox()
+__device__ bool intersectBox(const GpuMarchParams& params, float3 o, float3 d, float& tMin, float& tMax) {
+    float ix = 1.0f / d.x, iy = 1.0f / d.y, iz = 1.0f / d.z;
+    float ax = (params.boundsMin[0] - o.x) * ix, bx = (params.boundsMax[0] - o.x) * ix;
+    float ay = (params.boundsMin[1] - o.y) * iy, by = (params.boundsMax[1] - o.y) * iy;
+    float az = (params.boundsMin[2] - o.z) * iz, bz = (params.boundsMax[2] - o.z) * iz;
+    tMin = fmaxf(fmaxf(fminf(ax, bx), fminf(ay, by)), fminf(az, bz));
+    tMax = fminf(fminf(fmaxf(ax, bx), fmaxf(ay, by)), fmaxf(az, bz));
+    return tMax >= tMin && tMax > 0.0f;
+}
+
+// Density at index position p, rounded to the nearest voxel or
+// trilinearly filtered like RaySampler
+template <class Accessor>
+__device__ float sampleDensity(Accessor& acc, float3 p, bool trilinear) {
+    if (!trilinear) {
+        return acc.getValue(nanovdb::Coord(static_cast<int>(floorf(p.x + 0.5f)), static_cast<int>(floorf(p.y + 0.5f)),
+                                           static_cast<int>(floorf(p.z + 0.5f))));
+    }
+    
+    const int i = static_cast<int>(floorf(p.x)), j = static_cast<int>(floorf(p.y)), k = static_cast<int>(floorf(p.z));
+    const float u = p.x - i, v = p.y - j, w = p.z - k;
+    auto value = [&](int dx, int dy, int dz) { return acc.getValue(nanovdb::Coord(i + dx, j + dy, k + dz)); };
+    auto lerp = [](float a, float b, float s) { return a + (b - a) * s; };
+    float x0 = lerp(lerp(value(0, 0, 0), value(0, 0, 1), w), lerp(value(0, 1, 0), value(0, 1, 1), w), v);
+    float x1 = lerp(lerp(value(1, 0, 0), value(1, 0, 1), w), lerp(value(1, 1, 0), value(1, 1, 1), w), v);
+    return lerp(x0, x1, u);
+}
+
+// Fixed-step shadow ray toward the light, as VolumeRenderer::traceShadowRay()
+template <class Accessor>
+__device__ float shadowTransmittance(Accessor& acc, const GpuMarchParams& params, float3 pos) {
+    const float3 lightDir = load(params.lightDir);
+    float tMin, tMax;
+    float transmittance = 1.0f;
+    if (!intersectBox(params, pos, lightDir, tMin, tMax)) {
+        return transmittance;
+    }
+    
+    const float3 indexOrigin = toIndex(params.worldToIndex, pos, 1.0f);
+    const float3 indexDirection = toIndex(params.worldToIndex, lightDir, 0.0f);
+    const float tStart = ceilf(fmaxf(tMin, 0.0f) / params.stepSize) * params.stepSize;
+    for (float t = tStart; t < tMax && transmittance >= params.shadowCutoff; t += params.stepSize) {
+        float density = sampleDensity(acc, indexOrigin + indexDirection * t, params.trilinear);
+        transmittance *= expf(-density * params.stepSize);
+    }
+    return transmittance;
+}
+
+__device__ float evalPhase(const GpuMarchParams& params, float cosTheta) {
+    const float isotropic = static_cast<float>(1.0 / (4.0 * M_PI));
+    if (!params.henyeyGreenstein) {
+        return isotropic;
+    }
+    const float g = params.phaseG;
+    float denom = 1.0f + g * g - 2.0f * g * cosTheta;
+    return isotropic * (1.0f - g * g) / (denom * sqrtf(denom));
+}
+
+// One thread per pixel: the ray march of VolumeRenderer::marchKernel()
+// with fixed steps and exact or no shadows
+__global__ void marchPixels(const DensityGrid* grid, GpuMarchParams params, float* pixels) {
+    const int x = params.x0 + static_cast<int>(blockIdx.x * blockDim.x + threadIdx.x);
+    const int y = params.y0 + static_cast<int>(blockIdx.y * blockDim.y + threadIdx.y);
+    if (x >= params.x1 || y >= params.y1) return;
+    
+    auto acc = grid->getAccessor();
+    const float u = (x + 0.5f) / params.width;
+    const float v = 1.0f - (y + 0.5f) / params.height;  // Rows run top to bottom
+    const float3 origin = load(params.origin);
+    const float3 dir = normalized(load(params.forward) + load(params.right) * ((u - 0.5f) * params.viewportWidth) +
+                                  load(params.up) * ((v - 0.5f) * params.viewportHeight));
+    
+    float radiance = 0.0f;
+    float tMin, tMax;
+    if (intersectBox(params, origin, dir, tMin, tMax)) {
+        // A directional light scatters at a fixed angle along the ray
+        const float phase = evalPhase(params, dot(dir, load(params.lightDir)));
+        const float3 indexOrigin = toIndex(params.worldToIndex, origin, 1.0f);
+        const float3 indexDirection = toIndex(params.worldToIndex, dir, 0.0f);
+        float transmittance = 1.0f;
+        // Samples on the lattice of VolumeRenderer::latticeStart()
+        const float tStart = ceilf(tMin / params.stepSize) * params.stepSize;
+        for (float t = tStart; t < tMax && transmittance >= params.primaryCutoff; t += params.stepSize) {
+            float density = sampleDensity(acc, indexOrigin + indexDirection * t, params.trilinear);
+            if (density > 0.0f) {
+                float light = params.shadows ? shadowTransmittance(acc, params, origin + dir * t) : 1.0f;
+                float extinction = density * params.stepSize;
+                transmittance *= expf(-extinction);
+                radiance += phase * light * transmittance * extinction;
+            }
+        }
+    }
+    
+    float* out = pixels + 3 * (static_cast<size_t>(y - params.y0) * (params.x1 - params.x0) + (x - params.x0));
+    out[0] = out[1] = out[2] = radiance;
+}
+
+// Report a failed CUDA call; true on success
+bool check(cudaError_t status, const char* what) {
+    if (status == cudaSuccess) return true;
+    std::cerr << "CUDA error in " << what << ": " << cudaGetErrorString(status) << std::endl;
+    return false;
+}
+
+} // namespace
+
+bool gpuDeviceName(char* name, size_t size) {
+    int count = 0;
+    cudaDeviceProp properties;
+    if (cudaGetDeviceCount(&count) != cudaSuccess || count == 0 ||
+        cudaGetDeviceProperties(&properties, 0) != cudaSuccess) {
+        return false;
+    }
+    std::snprintf(name, size, "%s", properties.name);
+    return true;
+}
+
+GpuGrid* gpuUploadGrid(const void* data, size_t bytes) {
+    GpuGrid* grid = new GpuGrid;
+    grid->bytes = bytes;
+    if (!check(cudaMalloc(&grid->data, bytes), "grid allocation") ||
+        !check(cudaMemcpy(grid->data, data, bytes, cudaMemcpyHostToDevice), "grid upload")) {
+        gpuReleaseGrid(grid);
+        return nullptr;
+    }
+    return grid;
+}
+
+void gpuReleaseGrid(GpuGrid* grid) {
+    if (!grid) return;
+    cudaFree(grid->data);
+    delete grid;
+}
+
+bool gpuMarch(const GpuGrid* grid, const GpuMarchParams& params, float* pixels) {
+    const int width = params.x1 - params.x0, height = params.y1 - params.y0;
+    const size_t bytes = static_cast<size_t>(width) * height * 3 * sizeof(float);
+    float* devicePixels = nullptr;
+    if (!check(cudaMalloc(&devicePixels, bytes), "framebuffer allocation")) {
+        return false;
+    }
+    
+    // 16x8 pixel blocks keep the rays of a warp close together on screen
+    const dim3 block(16, 8);
+    const dim3 blocks((width + block.x - 1) / block.x, (height + block.y - 1) / block.y);
+    marchPixels<<<blocks, block>>>(static_cast<const DensityGrid*>(grid->data), params, devicePixels);
+    bool ok = check(cudaGetLastError(), "ray march launch") &&
+              check(cudaMemcpy(pixels, devicePixels, bytes, cudaMemcpyDeviceToHost), "framebuffer download");
+    cudaFree(devicePixels);
+    return ok;
+}
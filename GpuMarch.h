@@ -0,0 +1,45 @@
+#ifndef GPU_MARCH_H
+#define GPU_MARCH_H
+
+#include <cstddef>
+
+// Interface between GpuRenderer.h and the CUDA ray march in GpuMarch.cu.
+// It holds only plain data so it compiles in both the host and the device
+// translation units, keeping OpenVDB out of nvcc.
+
+// Everything the device march reads besides the grid
+struct GpuMarchParams {
+    float origin[3];       // Camera position
+    float forward[3];      // Camera basis and viewport extent at unit distance
+    float right[3];
+    float up[3];
+    float viewportWidth, viewportHeight;
+    float lightDir[3];
+    float boundsMin[3];    // World-space box of the active voxels
+    float boundsMax[3];
+    float worldToIndex[12]; // Affine density transform, row-major 3x4
+    float stepSize;
+    float primaryCutoff;
+    float shadowCutoff;
+    float phaseG;
+    bool henyeyGreenstein;
+    bool trilinear;
+    bool shadows;
+    int width, height;     // Full frame
+    int x0, y0, x1, y1;    // Region to trace, [x0, x1) x [y0, y1)
+};
+
+// NanoVDB density grid resident on the device
+struct GpuGrid;
+
+// Name of the first CUDA device; false when there is none
+bool gpuDeviceName(char* name, size_t size);
+
+// Copy a NanoVDB float grid buffer to the device, or nullptr on failure
+GpuGrid* gpuUploadGrid(const void* data, size_t bytes);
+void gpuReleaseGrid(GpuGrid* grid);
+
+// Trace the region into `pixels`, RGB rows of x1 - x0 pixels
+bool gpuMarch(const GpuGrid* grid, const GpuMarchParams& params, float* pixels);
+
+#endif // GPU_MARCH_H
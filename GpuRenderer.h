@@ -0,0 +1,151 @@
+#ifndef GPU_RENDERER_H
+#define GPU_RENDERER_H
+
+#include <openvdb/openvdb.h>
+#include <iostream>
+#include <string>
+
+#include "GpuMarch.h"
+#include "VolumeRenderer.h"
+
+#ifdef WITH_CUDA
+#if __has_include(<nanovdb/tools/CreateNanoGrid.h>)
+#include <nanovdb/tools/CreateNanoGrid.h>
+namespace nanovdb_tools = nanovdb::tools;
+#else
+#include <nanovdb/util/CreateNanoGrid.h>  // OpenVDB 11 and earlier
+namespace nanovdb_tools = nanovdb;
+#endif
+#endif
+
+// CUDA backend for volume_render, compiled in with VOLUME_RENDER_CUDA.
+// Each frame's density is converted to NanoVDB and uploaded once, and every
+// pixel of a region then runs the fixed-step march of VolumeRenderer::trace()
+// on the device, taking the camera, light, bounds and march settings from
+// the CPU renderer. Settings the device march lacks are reported by
+// unsupported(), and those renders stay on the CPU.
+class GpuRenderer {
+public:
+    GpuRenderer() = default;
+    ~GpuRenderer() { release(); }
+    
+    GpuRenderer(const GpuRenderer&) = delete;
+    GpuRenderer& operator=(const GpuRenderer&) = delete;
+    
+    // Whether this build has the backend and a CUDA device is present,
+    // naming the device in `device`
+    static bool available(std::string& device) {
+#ifdef WITH_CUDA
+        char name[256];
+        if (gpuDeviceName(name, sizeof(name))) {
+            device = name;
+            return true;
+        }
+#endif
+        (void)device;
+        return false;
+    }
+    
+    // The first setting of `renderer` the device march does not implement, or nullptr
+    static const char* unsupported(const VolumeRenderer& renderer) {
+        if (renderer.getIntegrator() != Integrator::RayMarch) return "delta tracking";
+        if (renderer.getSamplerMode() == SamplerMode::StochasticTrilinear) return "stochastic trilinear sampling";
+        if (renderer.getShadowMode() == ShadowMode::Cached) return "cached shadows";
+        if (renderer.getStepMode() != StepMode::Fixed) return "adaptive steps";
+        if (renderer.getTraversalMode() != TraversalMode::FixedStep) return "hierarchical traversal";
+        if (renderer.getRussianRoulette()) return "Russian roulette";
+        if (renderer.hasEmission()) return "emission";
+        if (renderer.hasMipLevels()) return "level of detail";
+        if (renderer.getBrickPool()) return "brick pools";
+        return nullptr;
+    }
+    
+    // Convert a frame's density to NanoVDB and upload it in place of the previous frame's
+    bool setGrid(const openvdb::FloatGrid& density) {
+        release();
+#ifdef WITH_CUDA
+        const openvdb::math::Transform& transform = density.transform();
+        if (!transform.isLinear()) {
+            std::cerr << "GPU rendering needs a linear grid transform" << std::endl;
+            return false;
+        }
+        
+        // Columns of the affine world-to-index map and its translation
+        const openvdb::Vec3d origin = transform.worldToIndex(openvdb::Vec3d(0.0));
+        for (int i = 0; i < 3; ++i) {
+            openvdb::Vec3d axis(0.0);
+            axis[i] = 1.0;
+            const openvdb::Vec3d column = transform.worldToIndex(axis) - origin;
+            for (int row = 0; row < 3; ++row) {
+                worldToIndex[row * 4 + i] = static_cast<float>(column[row]);
+            }
+        }
+        for (int row = 0; row < 3; ++row) {
+            worldToIndex[row * 4 + 3] = static_cast<float>(origin[row]);
+        }
+        
+        auto handle = nanovdb_tools::createNanoGrid(density);
+        grid = gpuUploadGrid(handle.data(), handle.size());
+        return grid != nullptr;
+#else
+        (void)density;
+        return false;
+#endif
+    }
+    
+    // Trace `region` of a width x height frame into `pixels`, which covers
+    // the region as in renderRegion()
+    bool renderRegion(const VolumeRenderer& renderer, const Camera& camera, int width, int height,
+                      const Tile& region, Image& pixels) const {
+#ifdef WITH_CUDA
+        if (!grid) return false;
+        
+        GpuMarchParams params;
+        auto copy = [](float* dst, const Vec3& v) {
+            dst[0] = v.x;
+            dst[1] = v.y;
+            dst[2] = v.z;
+        };
+        copy(params.origin, camera.getPosition());
+        copy(params.forward, camera.getForward());
+        copy(params.right, camera.getRight());
+        copy(params.up, camera.getUpVector());
+        params.viewportWidth = camera.getViewportWidth();
+        params.viewportHeight = camera.getViewportHeight();
+        copy(params.lightDir, renderer.getLightDir());
+        copy(params.boundsMin, renderer.getBoundsMin());
+        copy(params.boundsMax, renderer.getBoundsMax());
+        std::copy(std::begin(worldToIndex), std::end(worldToIndex), params.worldToIndex);
+        params.stepSize = renderer.getStepSize();
+        params.primaryCutoff = renderer.getPrimaryThreshold();
+        params.shadowCutoff = renderer.getShadowThreshold();
+        params.phaseG = renderer.getPhaseAsymmetry();
+        params.henyeyGreenstein = renderer.getPhaseFunction() == PhaseFunction::HenyeyGreenstein;
+        params.trilinear = renderer.getSamplerMode() == SamplerMode::Trilinear;
+        params.shadows = renderer.getShadowMode() != ShadowMode::None;
+        params.width = width;
+        params.height = height;
+        params.x0 = region.x0;
+        params.y0 = region.y0;
+        params.x1 = region.x1;
+        params.y1 = region.y1;
+        return gpuMarch(grid, params, pixels.data());
+#else
+        (void)renderer, (void)camera, (void)width, (void)height, (void)region, (void)pixels;
+        return false;
+#endif
+    }
+    
+private:
+    GpuGrid* grid = nullptr;
+    float worldToIndex[12] = {};
+    
+    void release() {
+#ifdef WITH_CUDA
+        gpuReleaseGrid(grid);
+#endif
+        grid = nullptr;
+    }
+};
+
+#endif // GPU_RENDERER_H
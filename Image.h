@@ -1,88 +1,99 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
-#include "Eigen/Dense"
+#include "ImageIO.h"
 #include <string>
-#include <fstream>
-#include <iostream>
+#include <vector>
 #include <algorithm>
+#include <cstddef>
 
+// Float framebuffer with interleaved channels (RGB or RGBA) in row-major
+// order, rows top to bottom. A pixel's channels share a cache line and a
+// row is one contiguous span, so scanline and tile writers stream through
+// memory. Values are stored as given and only clamped when quantized on
+// save, which keeps HDR output intact.
 class Image {
 private:
     int width;
     int height;
-    Eigen::MatrixXd red;
-    Eigen::MatrixXd green;
-    Eigen::MatrixXd blue;
+    int channels;
+    std::vector<float> pixels;
 
 public:
     // Constructor
-    Image(int w, int h) : width(w), height(h) {
-        red = Eigen::MatrixXd::Zero(height, width);
-        green = Eigen::MatrixXd::Zero(height, width);
-        blue = Eigen::MatrixXd::Zero(height, width);
-    }
+    Image(int w, int h, int c = 3)
+        : width(w), height(h), channels(c),
+          pixels(static_cast<size_t>(w) * h * c, 0.0f) {}
 
     // Getters
     int getWidth() const { return width; }
     int getHeight() const { return height; }
+    int getChannels() const { return channels; }
+
+    // Direct access to the interleaved samples
+    float* data() { return pixels.data(); }
+    const float* data() const { return pixels.data(); }
+    float* row(int y) { return pixels.data() + static_cast<size_t>(y) * width * channels; }
+    const float* row(int y) const { return pixels.data() + static_cast<size_t>(y) * width * channels; }
+    float* pixel(int x, int y) { return row(y) + static_cast<size_t>(x) * channels; }
+    const float* pixel(int x, int y) const { return row(y) + static_cast<size_t>(x) * channels; }
 
-    // Set color at specific pixel
+    // Set color at specific pixel; images with fewer than three channels
+    // keep only the leading components, e.g. r alone for a cost map
     void setPixel(int x, int y, double r, double g, double b) {
         if (x >= 0 && x < width && y >= 0 && y < height) {
-            red(y, x) = std::clamp(r, 0.0, 1.0);
-            green(y, x) = std::clamp(g, 0.0, 1.0);
-            blue(y, x) = std::clamp(b, 0.0, 1.0);
+            const double rgb[3] = {r, g, b};
+            float* p = pixel(x, y);
+            for (int c = 0; c < std::min(channels, 3); ++c) {
+                p[c] = static_cast<float>(rgb[c]);
+            }
         }
     }
 
-    // Get color at specific pixel
+    // Get color at specific pixel; missing channels repeat the last stored one
     void getPixel(int x, int y, double& r, double& g, double& b) const {
         if (x >= 0 && x < width && y >= 0 && y < height) {
-            r = red(y, x);
-            g = green(y, x);
-            b = blue(y, x);
+            const float* p = pixel(x, y);
+            r = p[0];
+            g = channels > 1 ? p[1] : r;
+            b = channels > 2 ? p[2] : g;
         }
     }
 
-    // Fill the entire image with a color
+    // Fill the entire image with a color, leading components only as in
+    // setPixel(); alpha, if present, becomes 1
     void fill(double r, double g, double b) {
-        red.setConstant(std::clamp(r, 0.0, 1.0));
-        green.setConstant(std::clamp(g, 0.0, 1.0));
-        blue.setConstant(std::clamp(b, 0.0, 1.0));
-    }
-
-    // Save image to PPM file
-    bool savePPM(const std::string& filename) const {
-        std::ofstream file(filename, std::ios::binary);
-        if (!file) {
-            std::cerr << "Error: Could not open file " << filename << std::endl;
-            return false;
+        const double rgb[3] = {r, g, b};
+        for (size_t i = 0; i < pixels.size(); i += channels) {
+            for (int c = 0; c < std::min(channels, 3); ++c) {
+                pixels[i + c] = static_cast<float>(rgb[c]);
+            }
+            if (channels > 3) pixels[i + 3] = 1.0f;
         }
+    }
 
-        // Write PPM header
-        file << "P3\n" << width << " " << height << "\n255\n";
+    // Copy `count` interleaved pixels into row y starting at column x0
+    void writeRow(int y, int x0, int count, const float* src) {
+        std::copy(src, src + static_cast<size_t>(count) * channels, pixel(x0, y));
+    }
 
-        // Write pixel data
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                // Convert from [0,1] to [0,255] range
-                int r = static_cast<int>(red(y, x) * 255);
-                int g = static_cast<int>(green(y, x) * 255);
-                int b = static_cast<int>(blue(y, x) * 255);
-                
-                file << r << " " << g << " " << b << " ";
-            }
-            file << "\n";
+    // Copy a tileWidth x tileHeight block of interleaved pixels, stored
+    // row-major with `srcStride` pixels per row, to (x0, y0)
+    void writeTile(int x0, int y0, int tileWidth, int tileHeight, const float* src, int srcStride) {
+        for (int y = 0; y < tileHeight; ++y) {
+            writeRow(y0 + y, x0, tileWidth, src + static_cast<size_t>(y) * srcStride * channels);
         }
+    }
 
-        return true;
+    // Save image to binary PPM file; a crop records its place in the frame
+    bool savePPM(const std::string& filename, const CropInfo* crop = nullptr) const {
+        return ImageIO::savePPM(filename, pixels.data(), width, height, channels, crop);
     }
 
-    // Get direct access to color channels
-    Eigen::MatrixXd& getRed() { return red; }
-    Eigen::MatrixXd& getGreen() { return green; }
-    Eigen::MatrixXd& getBlue() { return blue; }
+    // Save as PPM, or as float EXR for a .exr name
+    bool save(const std::string& filename, const CropInfo* crop = nullptr) const {
+        return ImageIO::save(filename, pixels.data(), width, height, channels, crop);
+    }
 };
 
-#endif // IMAGE_H 
\ No newline at end of file
+#endif // IMAGE_H
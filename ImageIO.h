@@ -0,0 +1,157 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef WITH_OPENEXR
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfOutputFile.h>
+#endif
+
+// Placement of a cropped image inside the full frame it was rendered from
+struct CropInfo {
+    int x = 0, y = 0;                   // Top-left pixel of the crop in the frame
+    int fullWidth = 0, fullHeight = 0;  // Size of the full frame
+};
+
+// Image writers shared by the renderers and tools. Float framebuffers hold
+// `channels` interleaved floats per pixel, RGB first, rows top to bottom.
+// A crop records its placement in the frame: a "# crop x y width height"
+// comment line after the P6 magic, or the EXR data and display windows.
+class ImageIO {
+public:
+    // Quantize `count` pixels to 8-bit RGB: clamp to [0, 1], scale by 255
+    // and truncate. Channels past RGB, such as alpha, are dropped.
+    static void quantize(const float* pixels, size_t count, int channels, unsigned char* rgb) {
+        if (channels == 3) {
+            // Same layout in and out, so one flat loop the compiler vectorizes
+            const size_t n = count * 3;
+            #pragma omp simd
+            for (size_t i = 0; i < n; ++i) {
+                rgb[i] = static_cast<unsigned char>(std::min(std::max(pixels[i], 0.0f), 1.0f) * 255.0f);
+            }
+            return;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                float v = std::min(std::max(pixels[i * channels + c], 0.0f), 1.0f);
+                rgb[i * 3 + c] = static_cast<unsigned char>(v * 255.0f);
+            }
+        }
+    }
+
+    // Save float pixels as binary P6, quantized straight into the output
+    // buffer behind the header and written with a single call
+    static bool savePPM(const std::string& filename, const float* pixels, int width, int height, int channels = 3,
+                        const CropInfo* crop = nullptr) {
+        std::string header = ppmHeader(width, height, crop);
+        std::vector<unsigned char> buffer(header.size() + static_cast<size_t>(width) * height * 3);
+        std::copy(header.begin(), header.end(), buffer.begin());
+        quantize(pixels, static_cast<size_t>(width) * height, channels, buffer.data() + header.size());
+        return writeFile(filename, buffer.data(), buffer.size());
+    }
+
+    // Save 8-bit RGB pixels as binary P6
+    static bool savePPM(const std::string& filename, const unsigned char* rgb, int width, int height,
+                        const CropInfo* crop = nullptr) {
+        std::string header = ppmHeader(width, height, crop);
+        std::vector<unsigned char> buffer(header.begin(), header.end());
+        buffer.insert(buffer.end(), rgb, rgb + static_cast<size_t>(width) * height * 3);
+        return writeFile(filename, buffer.data(), buffer.size());
+    }
+
+    // True when built with OpenEXR (WITH_OPENEXR)
+    static bool hasEXR() {
+#ifdef WITH_OPENEXR
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Save float pixels unclamped as a 32-bit float EXR. OpenEXR reads the
+    // framebuffer in place through strided slices, so nothing is copied.
+    // The fourth channel, if any, is written as alpha. A crop becomes the
+    // data window inside a display window covering the full frame.
+    static bool saveEXR(const std::string& filename, const float* pixels, int width, int height, int channels = 3,
+                        const CropInfo* crop = nullptr) {
+#ifdef WITH_OPENEXR
+        try {
+            const char* names[] = {"R", "G", "B", "A"};
+            const int written = std::min(channels, 4);
+            const size_t xStride = sizeof(float) * channels;
+            const size_t yStride = xStride * width;
+
+            Imath::Box2i dataWindow(Imath::V2i(0, 0), Imath::V2i(width - 1, height - 1));
+            Imath::Box2i displayWindow = dataWindow;
+            if (crop) {
+                dataWindow = Imath::Box2i(Imath::V2i(crop->x, crop->y), Imath::V2i(crop->x + width - 1, crop->y + height - 1));
+                displayWindow = Imath::Box2i(Imath::V2i(0, 0), Imath::V2i(crop->fullWidth - 1, crop->fullHeight - 1));
+            }
+
+            // Slices are addressed in data window coordinates
+            const ptrdiff_t origin = static_cast<ptrdiff_t>(dataWindow.min.x * xStride + dataWindow.min.y * yStride);
+            Imf::Header header(displayWindow, dataWindow);
+            Imf::FrameBuffer frameBuffer;
+            for (int c = 0; c < written; ++c) {
+                header.channels().insert(names[c], Imf::Channel(Imf::FLOAT));
+                char* base = reinterpret_cast<char*>(const_cast<float*>(pixels + c)) - origin;
+                frameBuffer.insert(names[c], Imf::Slice(Imf::FLOAT, base, xStride, yStride));
+            }
+
+            Imf::OutputFile file(filename.c_str(), header);
+            file.setFrameBuffer(frameBuffer);
+            file.writePixels(height);
+            return true;
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error: Could not write " << filename << ": " << e.what() << std::endl;
+            return false;
+        }
+#else
+        (void)pixels; (void)width; (void)height; (void)channels; (void)crop;
+        std::cerr << "Error: Built without OpenEXR, cannot write " << filename << std::endl;
+        return false;
+#endif
+    }
+
+    // Save by extension: .exr as float EXR, anything else as P6
+    static bool save(const std::string& filename, const float* pixels, int width, int height, int channels = 3,
+                     const CropInfo* crop = nullptr) {
+        return isEXR(filename) ? saveEXR(filename, pixels, width, height, channels, crop)
+                               : savePPM(filename, pixels, width, height, channels, crop);
+    }
+
+    static bool isEXR(const std::string& filename) {
+        return filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".exr") == 0;
+    }
+
+private:
+    static std::string ppmHeader(int width, int height, const CropInfo* crop) {
+        std::string header = "P6\n";
+        if (crop) {
+            header += "# crop " + std::to_string(crop->x) + " " + std::to_string(crop->y) + " " +
+                      std::to_string(crop->fullWidth) + " " + std::to_string(crop->fullHeight) + "\n";
+        }
+        return header + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    }
+
+    static bool writeFile(const std::string& filename, const unsigned char* data, size_t size) {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+        return static_cast<bool>(file);
+    }
+};
+
+#endif // IMAGE_IO_H
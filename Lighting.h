@@ -1,18 +1,63 @@
 #ifndef LIGHTING_H
 #define LIGHTING_H
 
-#include "Eigen/Dense"
+#include "VecMath.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 
+// Fast float log2 and exp2 for the vectorized Phong kernel: exponent bits
+// plus short polynomials, accurate to about 1e-5
+inline float fastLog2(float x) {
+    int32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    float exponent = static_cast<float>((bits >> 23) - 127);
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float m;
+    std::memcpy(&m, &bits, sizeof(m));
+    // log2(m) for m in [1, 2) through the atanh series in s = (m-1)/(m+1)
+    float s = (m - 1.0f) / (m + 1.0f);
+    float s2 = s * s;
+    float p = 0.142857143f;
+    p = p * s2 + 0.2f;
+    p = p * s2 + 0.333333333f;
+    p = p * s2 + 1.0f;
+    return exponent + 2.88539008f * s * p;
+}
+
+inline float fastExp2(float y) {
+    y = std::max(y, -126.0f);
+    float n = std::floor(y);
+    float f = y - n;
+    float p = 1.33335581e-3f;
+    p = p * f + 9.61812911e-3f;
+    p = p * f + 5.55041087e-2f;
+    p = p * f + 2.40226507e-1f;
+    p = p * f + 6.93147181e-1f;
+    p = p * f + 1.0f;
+    int32_t bits = (static_cast<int32_t>(n) + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+// x^y for x in [0, 1], as used for specular highlights
+inline float fastPow(float x, float y) {
+    float result = fastExp2(y * fastLog2(std::max(x, 1e-30f)));
+    return x > 0.0f ? result : 0.0f;
+}
+
 class Light {
 public:
-    Eigen::Vector3d position;
-    Eigen::Vector3d color;
+    Vec3d position;
+    Vec3d color;
     double intensity;
     double radius;  // Size of the light point
 
-    Light(const Eigen::Vector3d& pos = Eigen::Vector3d(0, 2, 0),
-          const Eigen::Vector3d& col = Eigen::Vector3d(1, 1, 1),
+    Light(const Vec3d& pos = Vec3d(0, 2, 0),
+          const Vec3d& col = Vec3d(1, 1, 1),
           double inten = 1.0,
           double rad = 0.1)
         : position(pos), color(col), intensity(inten), radius(rad) {}
@@ -28,8 +73,166 @@ private:
     double specularCoefficient;
     double shininess;
 
+    // Float structure-of-arrays copy of the lights for the vector kernel.
+    // With culling it is in cell order, duplicating a light once per cell
+    // it overlaps, so every cell's lights are one contiguous range.
+    struct LightArrays {
+        std::vector<float> x, y, z;
+        std::vector<float> r, g, b;
+        std::vector<float> intensity;
+        std::vector<float> radiusSq;
+
+        void clear() {
+            for (auto* v : {&x, &y, &z, &r, &g, &b, &intensity, &radiusSq}) v->clear();
+        }
+
+        void push(const Light& light, double radius) {
+            x.push_back(static_cast<float>(light.position.x));
+            y.push_back(static_cast<float>(light.position.y));
+            z.push_back(static_cast<float>(light.position.z));
+            r.push_back(static_cast<float>(light.color.x));
+            g.push_back(static_cast<float>(light.color.y));
+            b.push_back(static_cast<float>(light.color.z));
+            intensity.push_back(static_cast<float>(light.intensity));
+            radiusSq.push_back(static_cast<float>(radius * radius));
+        }
+
+        int size() const { return static_cast<int>(x.size()); }
+    };
+
+    // Uniform grid over the lights' spheres of influence, in CSR form: the
+    // lights overlapping cell c are packed[cellStart[c] .. cellStart[c+1])
+    double cullThreshold;
+    bool gridDirty;
+    Vec3d gridMin;
+    double cellSize;
+    int gridRes[3];
+    std::vector<int> cellStart;
+    LightArrays packed;
+
+    static constexpr int MaxGridRes = 64;
+
+    // Distance attenuation shared by shading and culling
+    static double attenuation(double distance) {
+        return 1.0 / (1.0 + 0.05 * distance + 0.001 * distance * distance);
+    }
+
+    // Distance beyond which intensity * attenuation drops below the threshold
+    double influenceRadius(const Light& light) const {
+        double ratio = light.intensity / cullThreshold;
+        if (ratio <= 1.0) return 0.0;
+        // Solve 0.001 d^2 + 0.05 d + 1 = ratio for d
+        return (-0.05 + std::sqrt(0.0025 + 0.004 * (ratio - 1.0))) / 0.002;
+    }
+
+    bool cellOf(const Vec3d& point, int cell[3]) const {
+        for (int a = 0; a < 3; ++a) {
+            cell[a] = static_cast<int>(std::floor((point[a] - gridMin[a]) / cellSize));
+            if (cell[a] < 0 || cell[a] >= gridRes[a]) return false;
+        }
+        return true;
+    }
+
+    int cellIndex(int x, int y, int z) const {
+        return (z * gridRes[1] + y) * gridRes[0] + x;
+    }
+
+    // Phong contribution of one light, including its attenuation
+    Vec3d shadeLight(const Light& light,
+                     const Vec3d& point,
+                     const Vec3d& normal,
+                     const Vec3d& viewDir,
+                     const Vec3d& baseColor) const {
+        // Calculate light direction
+        Vec3d lightDir = (light.position - point).normalized();
+        
+        // Calculate distance attenuation - reduced falloff
+        double distance = (light.position - point).length();
+        double falloff = attenuation(distance);
+        
+        // Calculate light contribution
+        Vec3d lightContribution(0, 0, 0);
+        
+        // Ambient component
+        lightContribution += ambientCoefficient * baseColor;
+        
+        // Diffuse component
+        double diffuseFactor = std::max(0.0, normal.dot(lightDir));
+        lightContribution += diffuseCoefficient * diffuseFactor * baseColor;
+        
+        // Specular component
+        Vec3d reflectDir = reflect(-lightDir, normal);
+        double specularFactor = std::pow(std::max(0.0, reflectDir.dot(viewDir)), shininess);
+        lightContribution += specularCoefficient * specularFactor * light.color;
+        
+        // This light's contribution with attenuation
+        return lightContribution * falloff * light.intensity;
+    }
+
+    // Phong lighting from packed lights [begin, end), in float and several
+    // lights per instruction. Lights farther than their influence radius
+    // are masked out rather than branched around.
+    Vec3d shadePacked(int begin, int end,
+                      const Vec3d& point,
+                      const Vec3d& normal,
+                      const Vec3d& viewDir,
+                      const Vec3d& baseColor) const {
+        const float px = static_cast<float>(point.x);
+        const float py = static_cast<float>(point.y);
+        const float pz = static_cast<float>(point.z);
+        const float nx = static_cast<float>(normal.x);
+        const float ny = static_cast<float>(normal.y);
+        const float nz = static_cast<float>(normal.z);
+        const float vx = static_cast<float>(viewDir.x);
+        const float vy = static_cast<float>(viewDir.y);
+        const float vz = static_cast<float>(viewDir.z);
+        const float ka = static_cast<float>(ambientCoefficient);
+        const float kd = static_cast<float>(diffuseCoefficient);
+        const float exponent = static_cast<float>(shininess);
+        
+        const float* lx = packed.x.data();
+        const float* ly = packed.y.data();
+        const float* lz = packed.z.data();
+        const float* lr = packed.r.data();
+        const float* lg = packed.g.data();
+        const float* lb = packed.b.data();
+        const float* li = packed.intensity.data();
+        const float* lradiusSq = packed.radiusSq.data();
+        
+        // Ambient and diffuse scale the base color; specular tints by light
+        float base = 0.0f, specR = 0.0f, specG = 0.0f, specB = 0.0f;
+        #pragma omp simd reduction(+:base, specR, specG, specB)
+        for (int i = begin; i < end; ++i) {
+            float dx = lx[i] - px;
+            float dy = ly[i] - py;
+            float dz = lz[i] - pz;
+            float distSq = dx * dx + dy * dy + dz * dz;
+            float invDist = 1.0f / std::sqrt(distSq);
+            float dist = distSq * invDist;
+            
+            float weight = li[i] / (1.0f + 0.05f * dist + 0.001f * distSq);
+            weight = distSq <= lradiusSq[i] ? weight : 0.0f;
+            
+            // Diffuse against the unit light direction
+            float nDotL = (nx * dx + ny * dy + nz * dz) * invDist;
+            base += weight * (ka + kd * std::max(nDotL, 0.0f));
+            
+            // Specular: reflect(-L, N) = 2 (N.L) N - L
+            float rx = 2.0f * nDotL * nx - dx * invDist;
+            float ry = 2.0f * nDotL * ny - dy * invDist;
+            float rz = 2.0f * nDotL * nz - dz * invDist;
+            float rDotV = rx * vx + ry * vy + rz * vz;
+            float spec = weight * fastPow(std::max(rDotV, 0.0f), exponent);
+            specR += spec * lr[i];
+            specG += spec * lg[i];
+            specB += spec * lb[i];
+        }
+        
+        return baseColor * static_cast<double>(base) + Vec3d(specR, specG, specB) * specularCoefficient;
+    }
+
     // Helper function to calculate reflection vector
-    Eigen::Vector3d reflect(const Eigen::Vector3d& incident, const Eigen::Vector3d& normal) const {
+    Vec3d reflect(const Vec3d& incident, const Vec3d& normal) const {
         return incident - 2.0 * incident.dot(normal) * normal;
     }
 
@@ -38,17 +241,111 @@ public:
         : ambientCoefficient(0.2),    // Increased ambient
           diffuseCoefficient(0.8),    // Increased diffuse
           specularCoefficient(0.5),   // Increased specular
-          shininess(16.0) {}          // Reduced shininess for broader highlights
+          shininess(16.0),            // Reduced shininess for broader highlights
+          cullThreshold(0.0),
+          gridDirty(true),
+          gridMin(0, 0, 0),
+          cellSize(1.0),
+          gridRes{0, 0, 0} {}
 
     // Add a new light
     void addLight(const Light& light) {
         lights.push_back(light);
+        gridDirty = true;
     }
 
 
     // Clear all lights
     void clearLights() {
         lights.clear();
+        gridDirty = true;
+    }
+
+    const std::vector<Light>& getLights() const { return lights; }
+
+    // Skip lights whose intensity * attenuation at the shaded point is below
+    // `threshold`. Each skipped light would have added at most about
+    // threshold * (ambient + diffuse + specular) per channel. 0 disables culling.
+    void setCullThreshold(double threshold) {
+        cullThreshold = threshold;
+        gridDirty = true;
+    }
+    double getCullThreshold() const { return cullThreshold; }
+
+    // Pack the lights for the vector kernel and, with culling on, bin them
+    // into the culling grid. Call after the last addLight and before shading
+    // from several threads; until then shading takes the scalar double loop
+    // over every light.
+    void buildLightGrid() {
+        cellStart.clear();
+        packed.clear();
+        gridRes[0] = gridRes[1] = gridRes[2] = 0;
+        gridDirty = false;
+        if (cullThreshold <= 0.0) {
+            for (const auto& light : lights) packed.push(light, INFINITY);
+            return;
+        }
+        if (lights.empty()) return;
+        
+        // Bound the spheres of influence; the smallest radius sets the cell size
+        std::vector<double> radii(lights.size());
+        Vec3d lo = Vec3d(INFINITY);
+        Vec3d hi = Vec3d(-INFINITY);
+        double minRadius = INFINITY;
+        for (size_t i = 0; i < lights.size(); ++i) {
+            radii[i] = influenceRadius(lights[i]);
+            if (radii[i] <= 0.0) continue;
+            lo = Vec3d::min(lo, lights[i].position - Vec3d(radii[i]));
+            hi = Vec3d::max(hi, lights[i].position + Vec3d(radii[i]));
+            minRadius = std::min(minRadius, radii[i]);
+        }
+        if (!(minRadius < INFINITY)) {
+            // Every light is below the threshold everywhere
+            cellStart.assign(1, 0);
+            return;
+        }
+        
+        Vec3d extent = hi - lo;
+        cellSize = std::max(minRadius, extent.maxComponent() / MaxGridRes);
+        gridMin = lo;
+        for (int a = 0; a < 3; ++a) {
+            gridRes[a] = std::max(1, std::min(MaxGridRes, static_cast<int>(std::ceil(extent[a] / cellSize))));
+        }
+        
+        // Two passes over each light's cell range: count, then scatter
+        const int cellCount = gridRes[0] * gridRes[1] * gridRes[2];
+        std::vector<int> cellLights;
+        cellStart.assign(cellCount + 1, 0);
+        for (int pass = 0; pass < 2; ++pass) {
+            std::vector<int> cursor;
+            if (pass == 1) {
+                for (int c = 0; c < cellCount; ++c) cellStart[c + 1] += cellStart[c];
+                cellLights.resize(cellStart[cellCount]);
+                cursor.assign(cellStart.begin(), cellStart.end() - 1);
+            }
+            for (size_t i = 0; i < lights.size(); ++i) {
+                if (radii[i] <= 0.0) continue;
+                int c0[3], c1[3];
+                for (int a = 0; a < 3; ++a) {
+                    c0[a] = std::max(0, static_cast<int>(std::floor((lights[i].position[a] - radii[i] - gridMin[a]) / cellSize)));
+                    c1[a] = std::min(gridRes[a] - 1, static_cast<int>(std::floor((lights[i].position[a] + radii[i] - gridMin[a]) / cellSize)));
+                }
+                for (int z = c0[2]; z <= c1[2]; ++z) {
+                    for (int y = c0[1]; y <= c1[1]; ++y) {
+                        for (int x = c0[0]; x <= c1[0]; ++x) {
+                            int c = cellIndex(x, y, z);
+                            if (pass == 0) {
+                                ++cellStart[c + 1];
+                            } else {
+                                cellLights[cursor[c]++] = static_cast<int>(i);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        
+        for (int i : cellLights) packed.push(lights[i], radii[i]);
     }
 
     // Getters and setters for Phong parameters
@@ -58,43 +355,32 @@ public:
     void setShininess(double s) { shininess = s; }
 
     // Calculate Phong BRDF lighting from all lights
-    Eigen::Vector3d calculatePhongLighting(
-        const Eigen::Vector3d& point,
-        const Eigen::Vector3d& normal,
-        const Eigen::Vector3d& viewDir,
-        const Eigen::Vector3d& baseColor) const {
+    Vec3d calculatePhongLighting(
+        const Vec3d& point,
+        const Vec3d& normal,
+        const Vec3d& viewDir,
+        const Vec3d& baseColor) const {
         
-        Eigen::Vector3d totalLight(0, 0, 0);
+        Vec3d totalLight(0, 0, 0);
         
-        for (const auto& light : lights) {
-            // Calculate light direction
-            Eigen::Vector3d lightDir = (light.position - point).normalized();
-            
-            // Calculate distance attenuation - reduced falloff
-            double distance = (light.position - point).norm();
-            double attenuation = 1.0 / (1.0 + 0.05 * distance + 0.001 * distance * distance);
-            
-            // Calculate light contribution
-            Eigen::Vector3d lightContribution(0, 0, 0);
-            
-            // Ambient component
-            lightContribution += ambientCoefficient * baseColor;
-            
-            // Diffuse component
-            double diffuseFactor = std::max(0.0, normal.dot(lightDir));
-            lightContribution += diffuseCoefficient * diffuseFactor * baseColor;
-            
-            // Specular component
-            Eigen::Vector3d reflectDir = reflect(-lightDir, normal);
-            double specularFactor = std::pow(std::max(0.0, reflectDir.dot(viewDir)), shininess);
-            lightContribution += specularCoefficient * specularFactor * light.color;
-            
-            // Add this light's contribution with attenuation
-            totalLight += lightContribution * attenuation * light.intensity;
+        if (gridDirty) {
+            for (const auto& light : lights) {
+                totalLight += shadeLight(light, point, normal, viewDir, baseColor);
+            }
+        } else if (cullThreshold <= 0.0) {
+            totalLight = shadePacked(0, packed.size(), point, normal, viewDir, baseColor);
+        } else {
+            // Only lights whose sphere of influence overlaps this cell; outside
+            // the grid every light is culled
+            int cell[3];
+            if (cellOf(point, cell)) {
+                int c = cellIndex(cell[0], cell[1], cell[2]);
+                totalLight = shadePacked(cellStart[c], cellStart[c + 1], point, normal, viewDir, baseColor);
+            }
         }
         
         // Clamp the result to [0,1]
-        return totalLight.cwiseMax(0.0).cwiseMin(1.0);
+        return Vec3d::min(Vec3d::max(totalLight, Vec3d(0.0)), Vec3d(1.0));
     }
 };
 
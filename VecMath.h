@@ -0,0 +1,78 @@
+#ifndef VEC_MATH_H
+#define VEC_MATH_H
+
+#include <algorithm>
+#include <cmath>
+
+// Small vector math shared by the volume and ground-scene renderers,
+// templated on the scalar type. Everything but the square roots is
+// constexpr, and the types are plain aggregates of three scalars, so
+// arrays of them are tightly packed.
+template <typename T>
+struct Vec3T {
+    T x, y, z;
+
+    constexpr Vec3T() : x(0), y(0), z(0) {}
+    constexpr explicit Vec3T(T s) : x(s), y(s), z(s) {}
+    constexpr Vec3T(T x_, T y_, T z_) : x(x_), y(y_), z(z_) {}
+
+    // Explicit conversion between precisions
+    template <typename U>
+    constexpr explicit Vec3T(const Vec3T<U>& v)
+        : x(static_cast<T>(v.x)), y(static_cast<T>(v.y)), z(static_cast<T>(v.z)) {}
+
+    [[nodiscard]] constexpr T operator[](int i) const { return i == 0 ? x : (i == 1 ? y : z); }
+    constexpr T& operator[](int i) { return i == 0 ? x : (i == 1 ? y : z); }
+
+    [[nodiscard]] constexpr Vec3T operator+(const Vec3T& v) const { return Vec3T(x + v.x, y + v.y, z + v.z); }
+    [[nodiscard]] constexpr Vec3T operator-(const Vec3T& v) const { return Vec3T(x - v.x, y - v.y, z - v.z); }
+    [[nodiscard]] constexpr Vec3T operator-() const { return Vec3T(-x, -y, -z); }
+    [[nodiscard]] constexpr Vec3T operator*(T f) const { return Vec3T(x * f, y * f, z * f); }
+    [[nodiscard]] constexpr Vec3T operator/(T f) const { return Vec3T(x / f, y / f, z / f); }
+
+    constexpr Vec3T& operator+=(const Vec3T& v) { x += v.x; y += v.y; z += v.z; return *this; }
+    constexpr Vec3T& operator-=(const Vec3T& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+    constexpr Vec3T& operator*=(T f) { x *= f; y *= f; z *= f; return *this; }
+
+    [[nodiscard]] constexpr T dot(const Vec3T& v) const { return x * v.x + y * v.y + z * v.z; }
+    [[nodiscard]] constexpr Vec3T cross(const Vec3T& v) const {
+        return Vec3T(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
+    }
+    [[nodiscard]] constexpr Vec3T componentMul(const Vec3T& v) const {
+        return Vec3T(x * v.x, y * v.y, z * v.z);
+    }
+    [[nodiscard]] constexpr T lengthSquared() const { return dot(*this); }
+    [[nodiscard]] constexpr T maxComponent() const { return std::max(x, std::max(y, z)); }
+
+    [[nodiscard]] T length() const { return std::sqrt(lengthSquared()); }
+    [[nodiscard]] Vec3T normalized() const { return *this * (T(1) / length()); }
+
+    [[nodiscard]] static constexpr Vec3T max(const Vec3T& a, const Vec3T& b) {
+        return Vec3T(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+    }
+    [[nodiscard]] static constexpr Vec3T min(const Vec3T& a, const Vec3T& b) {
+        return Vec3T(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+    }
+};
+
+template <typename T>
+[[nodiscard]] constexpr Vec3T<T> operator*(T f, const Vec3T<T>& v) { return v * f; }
+
+// Ray with a unit direction. Callers normalize once where the direction is
+// made; the constructor takes it as given.
+template <typename T>
+struct RayT {
+    Vec3T<T> origin;
+    Vec3T<T> direction;
+
+    constexpr RayT(const Vec3T<T>& o, const Vec3T<T>& d) : origin(o), direction(d) {}
+
+    [[nodiscard]] constexpr Vec3T<T> at(T t) const { return origin + direction * t; }
+};
+
+using Vec3f = Vec3T<float>;
+using Vec3d = Vec3T<double>;
+using Rayf = RayT<float>;
+using Rayd = RayT<double>;
+
+#endif // VEC_MATH_H
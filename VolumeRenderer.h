@@ -0,0 +1,2143 @@
+#ifndef VOLUME_RENDERER_H
+#define VOLUME_RENDERER_H
+
+#include <openvdb/openvdb.h>
+#include <openvdb/tools/GridTransformer.h>
+#include <openvdb/tools/Interpolation.h>
+#include <openvdb/tools/Morphology.h>
+#include <openvdb/tools/RayIntersector.h>
+#include <openvdb/tree/LeafManager.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "BrickPool.h"
+#include "Camera.h"
+#include "Image.h"
+#include "VecMath.h"
+
+// Float vector, ray and camera from the shared math core
+using Vec3 = Vec3f;
+using Ray = Rayf;
+using Camera = CameraT<float>;
+
+// exp(x) for the Beer's law update: 2^(x log2 e) with the integer part
+// written straight into the float exponent and a degree-5 polynomial for
+// the fraction (relative error below 1e-4). Branch-free, so loops over
+// packet lanes vectorize.
+inline float fastExp(float x) {
+    x = std::max(x, -87.0f);
+    float y = x * 1.44269504f;
+    float n = std::floor(y);
+    float f = y - n;
+    float p = 1.33335581e-3f;
+    p = p * f + 9.61812911e-3f;
+    p = p * f + 5.55041087e-2f;
+    p = p * f + 2.40226507e-1f;
+    p = p * f + 6.93147181e-1f;
+    p = p * f + 1.0f;
+    int32_t bits = (static_cast<int32_t>(n) + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+// Normalised color of a black body at `kelvin`: Planck's law evaluated at
+// representative red, green and blue wavelengths, scaled so the largest
+// channel is 1 and faded in from the Draper point where visible glow begins
+inline Vec3 blackbodyColor(float kelvin) {
+    const double c2 = 1.4388e-2; // Second radiation constant, m*K
+    const double wavelengths[3] = {610e-9, 550e-9, 465e-9};
+    if (kelvin <= 0.0f) return Vec3(0.0f);
+    
+    double radiance[3];
+    for (int c = 0; c < 3; ++c) {
+        double l = wavelengths[c];
+        radiance[c] = 1.0 / (l * l * l * l * l * std::expm1(c2 / (l * kelvin)));
+    }
+    double peak = std::max(radiance[0], std::max(radiance[1], radiance[2]));
+    float glow = std::min(std::max((kelvin - 798.0f) / 700.0f, 0.0f), 1.0f);
+    return Vec3(radiance[0] / peak, radiance[1] / peak, radiance[2] / peak) * glow;
+}
+
+// Number of coherent primary rays marched together by the packet path
+constexpr int PacketSize = 8;
+
+// Structure-of-arrays bundle of rays, lane i holding ray i
+struct alignas(32) RayPacket {
+    float ox[PacketSize], oy[PacketSize], oz[PacketSize];
+    float dx[PacketSize], dy[PacketSize], dz[PacketSize];
+    int count = 0; // Valid lanes; the remaining lanes are masked off
+};
+
+// How shadow rays toward the light are evaluated
+enum class ShadowMode {
+    Exact,  // March a shadow ray for every dense sample
+    Cached, // Interpolate a precomputed light-transmittance grid
+    None    // Unshadowed: every sample sees the full light
+};
+
+// Angular distribution of single scattering
+enum class PhaseFunction {
+    Isotropic,        // 1 / (4 pi) in every direction
+    HenyeyGreenstein  // Forward (g > 0) or backward (g < 0) lobe of asymmetry g
+};
+
+// How far each march step advances
+enum class StepMode {
+    Fixed,   // Always stepSize
+    Adaptive // Scaled by the density bound of the current leaf
+};
+
+// Estimator for the single-scattering volume integral
+enum class Integrator {
+    RayMarch,     // Deterministic fixed or adaptive step quadrature
+    DeltaTracking // Unbiased delta tracking, ratio-tracked shadow rays
+};
+
+// How rays walk through the volume
+enum class TraversalMode {
+    FixedStep,    // March the whole active bounding box at stepSize
+    Hierarchical  // Only march inside active tiles and leaves (hierarchical DDA)
+};
+
+// How density is reconstructed between voxel centres
+enum class SamplerMode {
+    Nearest,            // Value of the closest voxel
+    Trilinear,          // Trilinear interpolation (openvdb::tools::BoxSampler)
+    StochasticTrilinear // Closest voxel to a jittered position, trilinear in expectation
+};
+
+// Policies the ray march kernel is instantiated on, see
+// VolumeRenderer::marchKernel(). Each axis lists its policies in the order
+// of the runtime setting that selects them.
+template <SamplerMode Mode>
+struct SamplerPolicy {
+    static constexpr SamplerMode mode = Mode;
+};
+
+struct IsotropicPhase {
+    static float eval(float, float) { return static_cast<float>(1.0 / (4.0 * M_PI)); }
+};
+
+// Normalized over the sphere; cosTheta is between the light's and the
+// scattered ray's directions of travel
+struct HenyeyGreensteinPhase {
+    static float eval(float cosTheta, float g) {
+        float denom = 1.0f + g * g - 2.0f * g * cosTheta;
+        return static_cast<float>(1.0 / (4.0 * M_PI)) * (1.0f - g * g) / (denom * std::sqrt(denom));
+    }
+};
+
+template <ShadowMode Mode>
+struct ShadowPolicy {
+    static constexpr ShadowMode mode = Mode;
+};
+
+template <bool Enabled>
+struct EmissionPolicy {
+    static constexpr bool enabled = Enabled;
+};
+
+// Whether shadow evaluation is timed into RenderStats::shadowSeconds
+template <bool TimeShadows>
+struct InstrumentationPolicy {
+    static constexpr bool timeShadows = TimeShadows;
+};
+
+using SamplerPolicies = std::tuple<SamplerPolicy<SamplerMode::Nearest>, SamplerPolicy<SamplerMode::Trilinear>,
+                                   SamplerPolicy<SamplerMode::StochasticTrilinear>>;
+using PhasePolicies = std::tuple<IsotropicPhase, HenyeyGreensteinPhase>;
+using ShadowPolicies = std::tuple<ShadowPolicy<ShadowMode::Exact>, ShadowPolicy<ShadowMode::Cached>,
+                                  ShadowPolicy<ShadowMode::None>>;
+using EmissionPolicies = std::tuple<EmissionPolicy<false>, EmissionPolicy<true>>;
+using InstrumentationPolicies = std::tuple<InstrumentationPolicy<false>, InstrumentationPolicy<true>>;
+
+// Build with VOLUME_RENDER_STATS=0 to compile the hot-path counters out
+#ifndef VOLUME_RENDER_STATS
+#define VOLUME_RENDER_STATS 1
+#endif
+
+constexpr bool RenderStatsEnabled = VOLUME_RENDER_STATS != 0;
+
+// Event counter for the tracing hot path. The disabled specialization has
+// no state, so its increments compile away and it always reads zero.
+template <bool Enabled>
+struct CounterT {
+    uint64_t count = 0;
+    
+    CounterT& operator++() { ++count; return *this; }
+    CounterT& operator+=(uint64_t n) { count += n; return *this; }
+    operator uint64_t() const { return count; }
+};
+
+template <>
+struct CounterT<false> {
+    CounterT& operator++() { return *this; }
+    CounterT& operator+=(uint64_t) { return *this; }
+    operator uint64_t() const { return 0; }
+};
+
+using Counter = CounterT<RenderStatsEnabled>;
+
+// Work done while tracing, counted per render context so threads never
+// share a counter; merge the contexts of a pool for frame totals
+struct RenderStats {
+    Counter primaryRays;
+    Counter primarySamples;
+    Counter emptySamples;         // Primary samples with no density
+    Counter terminatedRays;       // Primary rays cut off by transmittance inside the volume
+    Counter shadowRays;
+    Counter shadowSamples;
+    Counter emptyShadowSamples;
+    Counter terminatedShadowRays;
+    
+    // Sampler lookups, those landing in the block of the previous lookup,
+    // and block changes whose leaf was already in the accessor's node cache
+    Counter lookups;
+    Counter blockHits;
+    Counter accessorHits;
+    
+    // Thread time in shadow evaluation, only kept while RenderContext::timeShadows is set
+    double shadowSeconds = 0.0;
+    
+    uint64_t samples() const { return primarySamples + shadowSamples; }
+    
+    void merge(const RenderStats& other) {
+        primaryRays += other.primaryRays;
+        primarySamples += other.primarySamples;
+        emptySamples += other.emptySamples;
+        terminatedRays += other.terminatedRays;
+        shadowRays += other.shadowRays;
+        shadowSamples += other.shadowSamples;
+        emptyShadowSamples += other.emptyShadowSamples;
+        terminatedShadowRays += other.terminatedShadowRays;
+        lookups += other.lookups;
+        blockHits += other.blockHits;
+        accessorHits += other.accessorHits;
+        shadowSeconds += other.shadowSeconds;
+    }
+};
+
+// Samples a grid along one ray in index space. The ray is transformed into
+// index space once, so a sample costs a multiply-add instead of a full
+// transform evaluation, and the leaf-sized block holding the previous
+// lookup is kept so consecutive samples inside it skip the tree descent.
+// With a per-leaf bounds accessor it also tracks the maximum density of
+// that block for adaptive stepping.
+//
+// Extra channels (temperature, flame) sharing the density transform ride
+// along: the block cache holds one leaf per channel, probed together on
+// block entry, so a multi-channel sample reads the same buffer offset and
+// interpolation weights from each leaf without another tree descent.
+// Lookups and block cache hits are counted into the RenderStats given to
+// reset().
+//
+// With a brick pool, density at full resolution is read from the pool's
+// dense bricks instead, falling back to the tree where no brick covers the
+// sample; extra channels still come from their leaves.
+class RaySampler {
+public:
+    using LeafT = openvdb::FloatTree::LeafNodeType;
+    using Accessor = openvdb::FloatGrid::ConstAccessor;
+    
+    // Channel order of sampleChannels(); density is always channel 0
+    enum Channel { Density = 0, Temperature, Flame, MaxChannels };
+    
+    void reset(RenderStats& counters, const Accessor& acc, const openvdb::math::Transform& xform,
+               const Vec3& origin, const Vec3& direction,
+               const Accessor* leafMaxAcc = nullptr,
+               const Accessor* temperatureAcc = nullptr, const Accessor* flameAcc = nullptr) {
+        stats = &counters;
+        accessors[Density] = &acc;
+        accessors[Temperature] = temperatureAcc;
+        accessors[Flame] = flameAcc;
+        leafMaxAccessor = leafMaxAcc;
+        transform = &xform;
+        worldOrigin = origin;
+        worldDirection = direction;
+        linear = xform.isLinear();
+        if (linear) {
+            openvdb::Vec3d o(origin.x, origin.y, origin.z);
+            openvdb::Vec3d d(direction.x, direction.y, direction.z);
+            indexOrigin = xform.worldToIndex(o);
+            indexDirection = xform.worldToIndex(o + d) - indexOrigin;
+        }
+        blockOrigin = openvdb::Coord::max();
+        for (int c = 0; c < MaxChannels; ++c) {
+            leafs[c] = nullptr;
+        }
+        levelAccessors = nullptr;
+        levelCount = 0;
+        level = 0;
+        levelScale = 1.0f;
+        bricks = nullptr;
+        brickOrigin = openvdb::Coord::max();
+        brick = BrickPool::Brick();
+    }
+    
+    // Read density from a brick pool baked from the accessor's grid; call
+    // after reset()
+    void setBricks(const BrickPool* pool) { bricks = pool; }
+    
+    // Sample density from a mip pyramid instead: levels[k] reads a grid with
+    // voxels 2^k times larger, box-filtered so that coarse voxel j covers
+    // fine voxels 2^k j to 2^k (j + 1) - 1. A sample at time t uses the
+    // level whose voxels match the ray footprint there, t * voxelsPerT fine
+    // voxels, but never one finer than minLevel. Density-only; call after
+    // reset() without extra channels.
+    void setLevels(const Accessor* levels, int count, float voxelsPerT, int minLevel = 0) {
+        levelAccessors = levels;
+        levelCount = count;
+        levelVoxelsPerT = voxelsPerT;
+        levelMin = std::min(minLevel, count - 1);
+    }
+    
+    // Mip level of the last sample, and its voxel size relative to level 0
+    int currentLevel() const { return level; }
+    float stepScale() const { return levelScale; }
+    
+    // Density at ray time t
+    float sample(float t, SamplerMode mode, std::mt19937& rng) {
+        float density;
+        lookup(t, mode, rng, &density, 1);
+        return density;
+    }
+    
+    // Every channel at ray time t into values[MaxChannels]; channels
+    // without an accessor read as zero
+    void sampleChannels(float t, SamplerMode mode, std::mt19937& rng, float* values) {
+        lookup(t, mode, rng, values, MaxChannels);
+    }
+    
+    // Upper bound of the values in the block of the last sample
+    float blockMaxDensity() const { return blockMax; }
+    
+    // Ray time from the last density sample to where the ray leaves its
+    // block: the voxels that round into it for nearest lookups, or those
+    // whose trilinear stencil stays inside it. At most zero when the sample
+    // is outside that region, and unbounded for non-linear transforms.
+    float blockExit() const {
+        if (!linear) return std::numeric_limits<float>::max();
+        const openvdb::Int32 mask = ~(LeafT::DIM - 1);
+        openvdb::Coord origin = (lastFiltered ? openvdb::Coord::floor(lastPosition)
+                                              : openvdb::Coord::round(lastPosition)) & mask;
+        double exit = std::numeric_limits<double>::max();
+        for (int i = 0; i < 3; ++i) {
+            double d = indexDirection[i] / levelScale;
+            if (d == 0.0) continue;
+            double lo = origin[i] - (lastFiltered ? 0.0 : 0.5);
+            double hi = origin[i] + LeafT::DIM - (lastFiltered ? 1.0 : 0.5);
+            exit = std::min(exit, ((d > 0.0 ? hi : lo) - lastPosition[i]) / d);
+        }
+        return static_cast<float>(exit);
+    }
+    
+private:
+    RenderStats* stats = nullptr;
+    const Accessor* accessors[MaxChannels] = {nullptr, nullptr, nullptr};
+    const Accessor* leafMaxAccessor = nullptr;
+    const openvdb::math::Transform* transform = nullptr;
+    Vec3 worldOrigin, worldDirection;
+    openvdb::Vec3d indexOrigin, indexDirection;
+    bool linear = true;
+    
+    // Block of the previous lookup: per channel its leaf, or the
+    // tile/background value covering it when there is no leaf
+    openvdb::Coord blockOrigin = openvdb::Coord::max();
+    const LeafT* leafs[MaxChannels] = {nullptr, nullptr, nullptr};
+    float blockValues[MaxChannels] = {0.0f, 0.0f, 0.0f};
+    float blockMax = std::numeric_limits<float>::max();
+    
+    // Mip pyramid of the density, when set
+    const Accessor* levelAccessors = nullptr;
+    int levelCount = 0;
+    int levelMin = 0;
+    float levelVoxelsPerT = 0.0f;
+    int level = 0;
+    float levelScale = 1.0f;
+    
+    // Index position of the last density lookup, in the space of its
+    // level, and whether it was filtered, for blockExit()
+    openvdb::Vec3d lastPosition;
+    bool lastFiltered = false;
+    
+    // Brick pool, when set, and the brick of the previous brick lookup
+    // (without values where there is none)
+    const BrickPool* bricks = nullptr;
+    openvdb::Coord brickOrigin = openvdb::Coord::max();
+    BrickPool::Brick brick;
+    float brickMax = 0.0f;
+    
+    openvdb::Vec3d indexPosition(float t) const {
+        if (linear) {
+            return indexOrigin + indexDirection * t;
+        }
+        Vec3 p = worldOrigin + worldDirection * t;
+        return transform->worldToIndex(openvdb::Vec3d(p.x, p.y, p.z));
+    }
+    
+    // Switch to the level for time t and map level 0 index position p onto it
+    openvdb::Vec3d levelPosition(float t, const openvdb::Vec3d& p) {
+        float footprint = t * levelVoxelsPerT;
+        int k = footprint >= 2.0f ? std::min(static_cast<int>(std::ilogb(footprint)), levelCount - 1) : 0;
+        k = std::max(k, levelMin);
+        if (k != level) {
+            level = k;
+            levelScale = static_cast<float>(1 << k);
+            accessors[Density] = &levelAccessors[k];
+            blockOrigin = openvdb::Coord::max();
+            brickOrigin = openvdb::Coord::max();
+        }
+        if (level == 0) {
+            return p;
+        }
+        double offset = 0.5 * (levelScale - 1.0);
+        return (p - openvdb::Vec3d(offset)) / static_cast<double>(levelScale);
+    }
+    
+    void lookup(float t, SamplerMode mode, std::mt19937& rng, float* values, int count) {
+        ++stats->lookups;
+        openvdb::Vec3d p = indexPosition(t);
+        if (levelCount > 1) {
+            p = levelPosition(t, p);
+        }
+        if (bricks && level == 0) {
+            if (mode == SamplerMode::StochasticTrilinear) {
+                std::uniform_real_distribution<double> jitter(-0.5, 0.5);
+                p = p + openvdb::Vec3d(jitter(rng), jitter(rng), jitter(rng));
+                mode = SamplerMode::Nearest;
+            }
+            
+            // Extra channels from the tree first, so the brick sets blockMax
+            bool filter = mode == SamplerMode::Trilinear;
+            if (count > 1) {
+                if (filter) {
+                    trilinear(p, values, count, Temperature);
+                } else {
+                    nearest(p, values, count, Temperature);
+                }
+            }
+            if (brickLookup(p, filter, values[Density])) return;
+            count = 1;
+        }
+        switch (mode) {
+            case SamplerMode::Nearest:
+                nearest(p, values, count);
+                return;
+            case SamplerMode::Trilinear:
+                trilinear(p, values, count);
+                return;
+            case SamplerMode::StochasticTrilinear: {
+                std::uniform_real_distribution<double> jitter(-0.5, 0.5);
+                nearest(p + openvdb::Vec3d(jitter(rng), jitter(rng), jitter(rng)), values, count);
+                return;
+            }
+        }
+    }
+    
+    // Density at p from the brick pool; false where no brick covers it
+    bool brickLookup(const openvdb::Vec3d& p, bool filter, float& value) {
+        lastPosition = p;
+        lastFiltered = filter;
+        openvdb::Coord ijk = filter ? openvdb::Coord::floor(p) : openvdb::Coord::round(p);
+        openvdb::Coord origin = ijk & static_cast<openvdb::Int32>(~(BrickPool::Dim - 1));
+        if (origin == brickOrigin) {
+            ++stats->blockHits;
+        } else {
+            brickOrigin = origin;
+            uint32_t slot = bricks->find(ijk);
+            brick = slot == BrickPool::Empty ? BrickPool::Brick() : bricks->brick(slot);
+            if (brick.values) {
+                // The tree block cache no longer matches blockMax
+                brickMax = bricks->maxValue(slot);
+                blockOrigin = openvdb::Coord::max();
+            }
+        }
+        if (!brick.values) return false;
+        blockMax = brickMax;
+        
+        const openvdb::Coord local = ijk - origin;
+        const int n = BrickPool::offset(local.x(), local.y(), local.z());
+        if (!filter) {
+            value = bricks->decode(brick, n);
+            return true;
+        }
+        
+        // The apron holds the whole stencil; neighbour offsets in the x-major brick
+        const int dx = BrickPool::Stride * BrickPool::Stride, dy = BrickPool::Stride, dz = 1;
+        auto lerp = [](float a, float b, float s) { return a + (b - a) * s; };
+        auto stored = [&](int offset) { return bricks->decode(brick, n + offset); };
+        
+        float u = static_cast<float>(p.x() - ijk.x());
+        float v = static_cast<float>(p.y() - ijk.y());
+        float w = static_cast<float>(p.z() - ijk.z());
+        float x0 = lerp(lerp(stored(0), stored(dz), w), lerp(stored(dy), stored(dy + dz), w), v);
+        float x1 = lerp(lerp(stored(dx), stored(dx + dz), w), lerp(stored(dx + dy), stored(dx + dy + dz), w), v);
+        value = lerp(x0, x1, u);
+        return true;
+    }
+    
+    void enterBlock(const openvdb::Coord& ijk) {
+        openvdb::Coord origin = ijk & static_cast<openvdb::Int32>(~(LeafT::DIM - 1));
+        if (origin == blockOrigin) {
+            ++stats->blockHits;
+            return;
+        }
+        if constexpr (RenderStatsEnabled) {
+            if (accessors[Density]->isCached(ijk)) ++stats->accessorHits;
+        }
+        blockOrigin = origin;
+        for (int c = 0; c < MaxChannels; ++c) {
+            if (!accessors[c]) {
+                leafs[c] = nullptr;
+                blockValues[c] = 0.0f;
+                continue;
+            }
+            leafs[c] = accessors[c]->probeConstLeaf(ijk);
+            if (!leafs[c]) {
+                blockValues[c] = accessors[c]->getValue(ijk);
+            }
+        }
+        if (!leafs[Density]) {
+            blockMax = blockValues[Density];
+        } else if (leafMaxAccessor && level == 0) {
+            blockMax = leafMaxAccessor->getValue(origin >> LeafT::LOG2DIM);
+        } else {
+            blockMax = std::numeric_limits<float>::max();
+        }
+    }
+    
+    // Channels first to count - 1 at p from the leaves
+    void nearest(const openvdb::Vec3d& p, float* values, int count, int first = Density) {
+        if (first == Density) {
+            lastPosition = p;
+            lastFiltered = false;
+        }
+        openvdb::Coord ijk = openvdb::Coord::round(p);
+        enterBlock(ijk);
+        const openvdb::Index n = LeafT::coordToOffset(ijk);
+        for (int c = first; c < count; ++c) {
+            values[c] = leafs[c] ? leafs[c]->getValue(n) : blockValues[c];
+        }
+    }
+    
+    void trilinear(const openvdb::Vec3d& p, float* values, int count, int first = Density) {
+        if (first == Density) {
+            lastPosition = p;
+            lastFiltered = true;
+        }
+        openvdb::Coord ijk = openvdb::Coord::floor(p);
+        enterBlock(ijk);
+        
+        // The 2x2x2 stencil crosses into the next block; let BoxSampler
+        // gather it through the accessors
+        const openvdb::Int32 last = LeafT::DIM - 1;
+        if ((ijk.x() & last) == last || (ijk.y() & last) == last || (ijk.z() & last) == last) {
+            for (int c = first; c < count; ++c) {
+                values[c] = accessors[c] ? openvdb::tools::BoxSampler::sample(*accessors[c], p) : 0.0f;
+            }
+            return;
+        }
+        
+        // Neighbour offsets inside the leaf's x-major value buffer
+        const openvdb::Index dx = 1 << (2 * LeafT::LOG2DIM), dy = 1 << LeafT::LOG2DIM, dz = 1;
+        const openvdb::Index n = LeafT::coordToOffset(ijk);
+        auto lerp = [](float a, float b, float s) { return a + (b - a) * s; };
+        
+        float u = static_cast<float>(p.x() - ijk.x());
+        float v = static_cast<float>(p.y() - ijk.y());
+        float w = static_cast<float>(p.z() - ijk.z());
+        for (int c = first; c < count; ++c) {
+            const LeafT* leaf = leafs[c];
+            if (!leaf) {
+                values[c] = blockValues[c];
+                continue;
+            }
+            auto value = [&](openvdb::Index offset) { return leaf->getValue(offset); };
+            float x0 = lerp(lerp(value(n), value(n + dz), w), lerp(value(n + dy), value(n + dy + dz), w), v);
+            float x1 = lerp(lerp(value(n + dx), value(n + dx + dz), w),
+                            lerp(value(n + dx + dy), value(n + dx + dy + dz), w), v);
+            values[c] = lerp(x0, x1, u);
+        }
+    }
+};
+
+using VolumeIntersector = openvdb::tools::VolumeRayIntersector<openvdb::FloatGrid>;
+using RayTimeSpan = openvdb::math::Ray<double>::TimeSpan;
+
+// Per-thread mutable render state. Accessor node caches, intersector ray
+// state and random streams are all mutated while tracing, so every thread
+// traces with its own context against the shared, read-only renderer.
+struct RenderContext {
+    RenderContext(const openvdb::FloatGrid& density, const openvdb::FloatGrid* lightCache,
+                  const openvdb::FloatGrid* leafMax, const VolumeIntersector* masterIntersector,
+                  const openvdb::FloatGrid* temperature, const openvdb::FloatGrid* flame,
+                  std::seed_seq& seed)
+        : densityAccessor(density.getConstAccessor()), rng(seed)
+    {
+        if (temperature) {
+            temperatureAccessor = std::make_unique<openvdb::FloatGrid::ConstAccessor>(temperature->getConstAccessor());
+        }
+        if (flame) {
+            flameAccessor = std::make_unique<openvdb::FloatGrid::ConstAccessor>(flame->getConstAccessor());
+        }
+        if (lightCache) {
+            lightCacheAccessor = std::make_unique<openvdb::FloatGrid::ConstAccessor>(lightCache->getConstAccessor());
+        }
+        if (leafMax) {
+            leafMaxAccessor = std::make_unique<openvdb::FloatGrid::ConstAccessor>(leafMax->getConstAccessor());
+        }
+        if (masterIntersector) {
+            intersector = std::make_unique<VolumeIntersector>(*masterIntersector);
+        }
+    }
+    
+    openvdb::FloatGrid::ConstAccessor densityAccessor;
+    std::unique_ptr<openvdb::FloatGrid::ConstAccessor> lightCacheAccessor;
+    std::unique_ptr<openvdb::FloatGrid::ConstAccessor> leafMaxAccessor;
+    std::unique_ptr<openvdb::FloatGrid::ConstAccessor> temperatureAccessor;
+    std::unique_ptr<openvdb::FloatGrid::ConstAccessor> flameAccessor;
+    std::unique_ptr<VolumeIntersector> intersector;
+    std::mt19937 rng;
+    
+    // Density mip levels, level 0 first, when the renderer has a pyramid
+    std::vector<openvdb::FloatGrid::ConstAccessor> levelAccessors;
+    
+    // Scratch list of active spans along the current primary ray, reused
+    // across rays to avoid per-ray allocation
+    std::vector<RayTimeSpan> spans;
+    
+    // Density samplers for the current primary, shadow and packet rays
+    RaySampler primarySampler;
+    RaySampler shadowSampler;
+    RaySampler packetSamplers[PacketSize];
+    
+    RenderStats stats;
+    bool timeShadows = false;
+};
+
+// Work done by the last light cache bake, see setLightCacheReuse()
+struct LightCacheUpdate {
+    bool incremental = false;   // Updated from the previous frame's cache
+    size_t changedRegions = 0;  // Density leaves and tiles that drifted past the tolerance
+    size_t marchedVoxels = 0;   // Cache voxels whose shadow ray was marched
+    size_t reusedVoxels = 0;    // Cache voxels copied from the previous cache
+    double seconds = 0.0;
+};
+
+// Volume renderer class
+class VolumeRenderer {
+public:
+    VolumeRenderer(openvdb::FloatGrid::Ptr grid, const Vec3& lightDir, float stepSize = 0.1f)
+        : grid(grid), lightDir(lightDir.normalized()), stepSize(stepSize)
+    {
+        updateBounds();
+        gridMaxDensity = evalMaxDensity();
+    }
+    
+    // Swap in the grids of another frame, keeping every mode and scale and
+    // rebuilding the acceleration structures those modes use. A density
+    // brick pool baked with the frame replaces the one the renderer would
+    // bake. Contexts made for the previous grids must go through
+    // rebindContext() before tracing.
+    void setGrids(openvdb::FloatGrid::Ptr density, openvdb::FloatGrid::Ptr temperature = nullptr,
+                  openvdb::FloatGrid::Ptr flame = nullptr, std::shared_ptr<const BrickPool> bricks = nullptr) {
+        openvdb::FloatGrid::Ptr previousDensity = grid;
+        std::shared_ptr<const BrickPool> previousBricks = brickPool;
+        grid = density;
+        updateBounds();
+        gridMaxDensity = evalMaxDensity();
+        setEmissionGrids(temperature, flame);
+        if (bricks) {
+            setBrickPool(bricks);
+        } else {
+            setBrickPool(bakeBricks, brickEncoding);
+        }
+        setStepMode(stepMode);
+        setTraversalMode(traversalMode);
+        
+        // Update the light cache in place of a full bake when only the density changed
+        if (reuseLightCache && shadowMode == ShadowMode::Cached && lightCache &&
+            lightCacheKey == makeLightCacheKey(lightCacheDownsample) &&
+            previousDensity->transform() == grid->transform()) {
+            buildLightCache(lightCacheDownsample, previousDensity.get(), previousBricks.get());
+        } else {
+            setShadowMode(shadowMode, lightCacheDownsample);
+        }
+    }
+    
+    // Carry the light cache from frame to frame in setGrids(). The density
+    // is diffed leaf by leaf against the previous frame, and each leaf and
+    // tile accumulates its change over the frames since the shadow rays
+    // through it were last marched. Only cache voxels whose shadow ray can
+    // pass through a leaf or tile that drifted by more than `tolerance` are
+    // marched again, so slow change spread over many frames is caught as
+    // well; the rest keep their transmittance. Any change of the light
+    // cache settings, the shadow march settings or the grid transform still
+    // bakes the whole cache.
+    void setLightCacheReuse(bool enabled, float tolerance = 1e-3f) {
+        reuseLightCache = enabled;
+        lightCacheTolerance = std::max(tolerance, 0.0f);
+    }
+    
+    const LightCacheUpdate& getLightCacheUpdate() const { return lightCacheUpdate; }
+    
+    // Select the shadow evaluation mode. Cached mode bakes the light
+    // transmittance once for the current light direction, optionally on a
+    // grid `cacheDownsample` times coarser than the density.
+    void setShadowMode(ShadowMode mode, int cacheDownsample = 1) {
+        shadowMode = mode;
+        lightCacheDownsample = std::max(cacheDownsample, 1);
+        if (shadowMode == ShadowMode::Cached) {
+            buildLightCache(lightCacheDownsample);
+        } else {
+            lightCache.reset();
+        }
+    }
+    
+    ShadowMode getShadowMode() const { return shadowMode; }
+    
+    // Bake the density into a dense brick pool that full-resolution density
+    // samples read instead of the tree, rebaking it for every new frame.
+    // Call this after setEmissionGrids(), whose topology union the pool must
+    // cover, and before the shadow mode so a light cache bake reads it too.
+    void setBrickPool(bool enabled, BrickEncoding encoding = BrickEncoding::Half) {
+        bakeBricks = enabled;
+        brickEncoding = encoding;
+        brickPool.reset();
+        if (enabled) {
+            brickPool = std::make_shared<const BrickPool>(*grid, encoding);
+        }
+    }
+    
+    // Sample from a pool baked from the current density, which may since
+    // have had its leaves released (BrickPool::releaseLeaves). With
+    // emission the pool must be baked after matchEmissionTopology(), like a
+    // pool baked here after setEmissionGrids().
+    void setBrickPool(std::shared_ptr<const BrickPool> pool) {
+        bakeBricks = false;
+        brickPool = std::move(pool);
+    }
+    
+    const BrickPool* getBrickPool() const { return brickPool.get(); }
+    
+    // Select how primary and shadow rays traverse the volume. Set this
+    // before the shadow mode so a light cache bake uses it too.
+    void setTraversalMode(TraversalMode mode) {
+        traversalMode = mode;
+        if (traversalMode == TraversalMode::Hierarchical) {
+            // Dilate by one voxel so samples rounding into a neighbouring
+            // leaf are still inside a marched span
+            intersector = std::make_unique<VolumeIntersector>(*grid, 1);
+        } else {
+            intersector.reset();
+        }
+    }
+    
+    TraversalMode getTraversalMode() const { return traversalMode; }
+    
+    // March up to PacketSize rays in lockstep, writing one color per valid
+    // lane. Positions, box intersection and the Beer's law update run over
+    // all lanes at once; only the density and light fetches are per lane.
+    // Lanes that leave the box or saturate are masked off until every lane
+    // is done. Hierarchical traversal and delta tracking have no lockstep
+    // form, so they fall back to tracing each lane on its own.
+    void tracePacket(const RayPacket& packet, RenderContext& ctx, Vec3* colors) const {
+        if (traversalMode == TraversalMode::Hierarchical || integrator == Integrator::DeltaTracking) {
+            for (int i = 0; i < packet.count; ++i) {
+                Ray ray(Vec3(packet.ox[i], packet.oy[i], packet.oz[i]),
+                        Vec3(packet.dx[i], packet.dy[i], packet.dz[i]));
+                colors[i] = trace(ray, ctx);
+            }
+            return;
+        }
+        
+        alignas(32) float t[PacketSize], tMax[PacketSize], alive[PacketSize];
+        alignas(32) float px[PacketSize], py[PacketSize], pz[PacketSize];
+        alignas(32) float extinction[PacketSize], light[PacketSize], dt[PacketSize];
+        alignas(32) float transmittance[PacketSize], radiance[PacketSize];
+        alignas(32) float emitR[PacketSize], emitG[PacketSize], emitB[PacketSize];
+        alignas(32) float glowR[PacketSize], glowG[PacketSize], glowB[PacketSize];
+        
+        ctx.stats.primaryRays += packet.count;
+        intersectBoxPacket(packet, t, tMax, alive);
+        for (int i = 0; i < PacketSize; ++i) {
+            t[i] = latticeStart(t[i]);
+        }
+        for (int i = 0; i < PacketSize; ++i) {
+            ctx.packetSamplers[i].reset(ctx.stats, ctx.densityAccessor, grid->transform(),
+                                        Vec3(packet.ox[i], packet.oy[i], packet.oz[i]),
+                                        Vec3(packet.dx[i], packet.dy[i], packet.dz[i]),
+                                        ctx.leafMaxAccessor.get(),
+                                        ctx.temperatureAccessor.get(), ctx.flameAccessor.get());
+            useLevels(ctx, ctx.packetSamplers[i], mipVoxelsPerT);
+        }
+        
+        #pragma omp simd
+        for (int i = 0; i < PacketSize; ++i) {
+            transmittance[i] = 1.0f;
+            radiance[i] = 0.0f;
+            glowR[i] = glowG[i] = glowB[i] = 0.0f;
+        }
+        
+        // A directional light scatters at a fixed angle along each ray
+        alignas(32) float phase[PacketSize];
+        for (int i = 0; i < PacketSize; ++i) {
+            phase[i] = evalPhase(packet.dx[i] * lightDir.x + packet.dy[i] * lightDir.y + packet.dz[i] * lightDir.z);
+        }
+        
+        float anyAlive = 1.0f;
+        while (anyAlive > 0.0f) {
+            #pragma omp simd
+            for (int i = 0; i < PacketSize; ++i) {
+                px[i] = packet.ox[i] + packet.dx[i] * t[i];
+                py[i] = packet.oy[i] + packet.dy[i] * t[i];
+                pz[i] = packet.oz[i] + packet.dz[i] * t[i];
+            }
+            
+            // Batched density and emission fetch; masked lanes contribute nothing
+            for (int i = 0; i < PacketSize; ++i) {
+                float density = 0.0f;
+                Vec3 emitted(0.0f);
+                dt[i] = stepSize;
+                if (alive[i] > 0.0f) {
+                    ++ctx.stats.primarySamples;
+                    if (hasEmission()) {
+                        float values[RaySampler::MaxChannels];
+                        ctx.packetSamplers[i].sampleChannels(t[i], samplerMode, ctx.rng, values);
+                        density = values[RaySampler::Density];
+                        dt[i] = nextStep(ctx.packetSamplers[i]);
+                        emitted = emission(values) * dt[i];
+                    } else {
+                        density = ctx.packetSamplers[i].sample(t[i], samplerMode, ctx.rng);
+                        dt[i] = nextStep(ctx.packetSamplers[i]);
+                    }
+                    if (density <= 0.0f) ++ctx.stats.emptySamples;
+                }
+                extinction[i] = std::max(density, 0.0f) * dt[i];
+                emitR[i] = emitted.x;
+                emitG[i] = emitted.y;
+                emitB[i] = emitted.z;
+            }
+            
+            for (int i = 0; i < PacketSize; ++i) {
+                light[i] = extinction[i] > 0.0f
+                         ? lightTransmittance(ctx, Vec3(px[i], py[i], pz[i]), ctx.packetSamplers[i].currentLevel())
+                         : 0.0f;
+            }
+            
+            // Beer's law, in-scattering and lane retirement
+            #pragma omp simd
+            for (int i = 0; i < PacketSize; ++i) {
+                transmittance[i] *= fastExp(-extinction[i]);
+                radiance[i] += phase[i] * light[i] * transmittance[i] * extinction[i];
+                glowR[i] += emitR[i] * transmittance[i];
+                glowG[i] += emitG[i] * transmittance[i];
+                glowB[i] += emitB[i] * transmittance[i];
+                t[i] += dt[i];
+                float inside = t[i] < tMax[i] ? 1.0f : 0.0f;
+                alive[i] *= inside;
+            }
+            
+            // Termination draws random numbers, so it runs per lane
+            for (int i = 0; i < PacketSize; ++i) {
+                if (alive[i] > 0.0f && !survives(transmittance[i], primaryCutoff, ctx)) {
+                    alive[i] = 0.0f;
+                    ++ctx.stats.terminatedRays;
+                }
+            }
+            
+            anyAlive = 0.0f;
+            for (int i = 0; i < PacketSize; ++i) {
+                anyAlive = std::max(anyAlive, alive[i]);
+            }
+        }
+        
+        for (int i = 0; i < packet.count; ++i) {
+            colors[i] = Vec3(radiance[i] + glowR[i], radiance[i] + glowG[i], radiance[i] + glowB[i]);
+        }
+    }
+    
+    // Create the state one thread needs to trace against this renderer.
+    // `stream` selects an independent random sequence for the same seed.
+    RenderContext makeContext(uint32_t seed, uint32_t stream) const {
+        std::seed_seq seq{seed, stream};
+        RenderContext ctx(*grid, lightCache.get(), leafMax.get(), intersector.get(),
+                          temperatureGrid.get(), flameGrid.get(), seq);
+        bindLevels(ctx);
+        return ctx;
+    }
+    
+    // Point a context at the current grids and acceleration structures after
+    // setGrids(), keeping its random stream and scratch buffers
+    void rebindContext(RenderContext& ctx) const {
+        auto bind = [](std::unique_ptr<openvdb::FloatGrid::ConstAccessor>& acc, const openvdb::FloatGrid* target) {
+            if (target) {
+                acc = std::make_unique<openvdb::FloatGrid::ConstAccessor>(target->getConstAccessor());
+            } else {
+                acc.reset();
+            }
+        };
+        ctx.densityAccessor = grid->getConstAccessor();
+        bind(ctx.lightCacheAccessor, lightCache.get());
+        bind(ctx.leafMaxAccessor, leafMax.get());
+        bind(ctx.temperatureAccessor, temperatureGrid.get());
+        bind(ctx.flameAccessor, flameGrid.get());
+        if (intersector) {
+            ctx.intersector = std::make_unique<VolumeIntersector>(*intersector);
+        } else {
+            ctx.intersector.reset();
+        }
+        bindLevels(ctx);
+    }
+    
+    // Sample density from coarser copies of the grid where a pixel covers
+    // several voxels. levels[k - 1] has voxels 2^k times the density's,
+    // box-filtered (see RaySampler::setLevels); footprintPerDistance is the
+    // world-space pixel width at unit distance from the camera. Shadow rays
+    // use the level of the sample they start from. Emission channels have
+    // no pyramid, so the levels are ignored while emitting.
+    void setMipLevels(std::vector<openvdb::FloatGrid::Ptr> levels, float footprintPerDistance) {
+        mipLevels = std::move(levels);
+        mipVoxelsPerT = footprintPerDistance / static_cast<float>(grid->voxelSize()[0]);
+    }
+    
+    bool hasMipLevels() const { return !mipLevels.empty() && !hasEmission(); }
+    
+    void setSamplerMode(SamplerMode mode) { samplerMode = mode; }
+    SamplerMode getSamplerMode() const { return samplerMode; }
+    
+    // Voxels fetched per density sample by the current filter
+    int lookupsPerSample() const { return samplerMode == SamplerMode::Trilinear ? 8 : 1; }
+    
+    // Adaptive stepping keeps stepSize in the leaves holding the grid's
+    // maximum density and stretches it by gridMax / leafMax elsewhere, up
+    // to one leaf width. A stretched step also ends where the ray leaves the
+    // leaf it was sampled in, so it never carries a thin leaf's density into
+    // a denser neighbour, and no step sees more optical depth than a fixed
+    // step through the densest region. Set this before the shadow mode so
+    // a light cache bake uses it too.
+    void setStepMode(StepMode mode) {
+        stepMode = mode;
+        if (stepMode == StepMode::Adaptive) {
+            buildLeafBounds();
+        } else {
+            leafMax.reset();
+        }
+    }
+    
+    StepMode getStepMode() const { return stepMode; }
+    
+    // Change the base ray march step, keeping the adaptive step bounds
+    void setStepSize(float size) {
+        stepSize = size;
+        if (stepMode == StepMode::Adaptive) {
+            maxStepSize = std::max(leafWidth(), stepSize);
+        }
+    }
+    
+    float getStepSize() const { return stepSize; }
+    
+    // Emit blackbody light from a temperature grid, weighted by the flame
+    // grid when given and by density otherwise. The grids are shared, not
+    // copied, and matchEmissionTopology() edits them in place: the density
+    // and channel trees passed in (the density given to the constructor or
+    // setGrids()) come back with the unioned topology. Loaders that edit
+    // the density themselves should match the topology first. Call this
+    // before the step, traversal and shadow modes, which build acceleration
+    // structures from the density topology.
+    void setEmissionGrids(openvdb::FloatGrid::Ptr temperature, openvdb::FloatGrid::Ptr flame = nullptr) {
+        temperatureGrid = temperature;
+        flameGrid = temperature ? flame : nullptr;
+        if (!temperatureGrid) return;
+        
+        if (blackbodyTable.empty()) {
+            blackbodyTable.resize(BlackbodyTableSize);
+            for (int i = 0; i < BlackbodyTableSize; ++i) {
+                blackbodyTable[i] = blackbodyColor(MaxBlackbodyKelvin * i / (BlackbodyTableSize - 1));
+            }
+        }
+        
+        matchEmissionTopology(*grid, temperatureGrid, flameGrid);
+        updateBounds();
+    }
+    
+    // Resample emission channels whose transform differs from the density
+    // onto it, replacing `temperature` and `flame`, and union the three
+    // trees in place to one active topology, so the samplers find the same
+    // blocks in every channel and traversal covers flame outside the smoke.
+    // Active density tiles are kept as tiles, so the leaf-maximum tiles
+    // left by BrickPool::releaseLeaves() are never refilled as leaves and
+    // matching grids again changes nothing.
+    static void matchEmissionTopology(openvdb::FloatGrid& density, openvdb::FloatGrid::Ptr& temperature,
+                                      openvdb::FloatGrid::Ptr& flame) {
+        if (!temperature) return;
+        temperature = alignTo(density, temperature);
+        if (flame) {
+            flame = alignTo(density, flame);
+        }
+        
+        density.tree().topologyUnion(temperature->tree(), true);
+        if (flame) {
+            density.tree().topologyUnion(flame->tree(), true);
+            flame->tree().topologyUnion(density.tree());
+        }
+        temperature->tree().topologyUnion(density.tree());
+    }
+    
+    // Kelvin per temperature grid unit, and the emitted radiance at full glow
+    // per unit flame (or density) and length
+    void setEmissionScale(float kelvinPerUnit, float intensity) {
+        temperatureScale = kelvinPerUnit;
+        emissionScale = intensity;
+    }
+    
+    bool hasEmission() const { return temperatureGrid != nullptr; }
+    
+    // Rays stop marching once their transmittance drops below a threshold,
+    // one for primary and one for shadow rays. With Russian roulette a ray
+    // below its threshold instead survives with probability
+    // transmittance / threshold and continues at the threshold, which keeps
+    // every estimate unbiased; without it the remaining light is dropped.
+    void setTermination(float primaryThreshold, float shadowThreshold, bool russianRoulette) {
+        primaryCutoff = std::max(primaryThreshold, 0.0f);
+        shadowCutoff = std::max(shadowThreshold, 0.0f);
+        roulette = russianRoulette;
+    }
+    
+    float getPrimaryThreshold() const { return primaryCutoff; }
+    float getShadowThreshold() const { return shadowCutoff; }
+    bool getRussianRoulette() const { return roulette; }
+    
+    // Delta tracking uses the grid's maximum density as the majorant
+    void setIntegrator(Integrator method) { integrator = method; }
+    Integrator getIntegrator() const { return integrator; }
+    
+    // Scattering lobe for the light toward the camera; the asymmetry g,
+    // clamped to (-1, 1), only applies to Henyey-Greenstein
+    void setPhaseFunction(PhaseFunction function, float g = 0.0f) {
+        phaseFunction = function;
+        phaseG = std::min(std::max(g, -0.99f), 0.99f);
+    }
+    
+    PhaseFunction getPhaseFunction() const { return phaseFunction; }
+    float getPhaseAsymmetry() const { return phaseG; }
+    
+    const Vec3& getLightDir() const { return lightDir; }
+    
+    // World-space box of the active voxels that every ray is clipped to
+    const Vec3& getBoundsMin() const { return t0; }
+    const Vec3& getBoundsMax() const { return t1; }
+    
+    Vec3 trace(const Ray& ray, RenderContext& ctx) const {
+        Vec3 color(0.0f);
+        ++ctx.stats.primaryRays;
+        ctx.primarySampler.reset(ctx.stats, ctx.densityAccessor, grid->transform(), ray.origin, ray.direction,
+                                 ctx.leafMaxAccessor.get(),
+                                 ctx.temperatureAccessor.get(), ctx.flameAccessor.get());
+        useLevels(ctx, ctx.primarySampler, mipVoxelsPerT);
+        
+        if (!findSpans(ray, ctx)) {
+            return color; // Miss
+        }
+        
+        if (integrator == Integrator::DeltaTracking) {
+            return deltaTrack(ray, ctx);
+        }
+        
+        // Ray march through every span from the first intersection
+        float transmittance = 1.0f;
+        for (const RayTimeSpan& span : ctx.spans) {
+            if (!survives(transmittance, primaryCutoff, ctx) ||
+                !marchSegment(ray, latticeStart(static_cast<float>(span.t0)), static_cast<float>(span.t1), ctx, color,
+                              transmittance)) {
+                ++ctx.stats.terminatedRays;
+                break;
+            }
+        }
+        
+        return color;
+    }
+    
+private:
+    openvdb::FloatGrid::Ptr grid;
+    openvdb::CoordBBox bounds;
+    Vec3 t0, t1;  // World-space bounds of the active voxels
+    Vec3 lightDir;
+    float stepSize;
+    ShadowMode shadowMode = ShadowMode::Exact;
+    TraversalMode traversalMode = TraversalMode::FixedStep;
+    SamplerMode samplerMode = SamplerMode::Nearest;
+    StepMode stepMode = StepMode::Fixed;
+    Integrator integrator = Integrator::RayMarch;
+    PhaseFunction phaseFunction = PhaseFunction::Isotropic;
+    float phaseG = 0.0f;
+    
+    // Early termination, see setTermination()
+    float primaryCutoff = 0.01f;
+    float shadowCutoff = 0.01f;
+    bool roulette = false;
+    
+    // Upper bound of every value the samplers can return
+    float gridMaxDensity = 0.0f;
+    
+    // Emission channels, sharing the density transform and topology
+    openvdb::FloatGrid::Ptr temperatureGrid;
+    openvdb::FloatGrid::Ptr flameGrid;
+    float temperatureScale = 1000.0f;
+    float emissionScale = 1.0f;
+    
+    // blackbodyColor() tabulated over [0, MaxBlackbodyKelvin]
+    static constexpr int BlackbodyTableSize = 1024;
+    static constexpr float MaxBlackbodyKelvin = 16000.0f;
+    std::vector<Vec3> blackbodyTable;
+    
+    // Maximum density of every leaf, one voxel per leaf, for adaptive steps
+    openvdb::FloatGrid::Ptr leafMax;
+    float maxStepSize = 0.0f;
+    
+    // Master intersector holding the dilated topology; each render context
+    // marches a shallow copy since the intersector carries per-ray state
+    std::unique_ptr<VolumeIntersector> intersector;
+    
+    // Light transmittance cache, sharing the density transform up to a scale
+    openvdb::FloatGrid::Ptr lightCache;
+    int lightCacheDownsample = 1;
+    
+    // Everything a light cache bake depends on besides the density values
+    struct LightCacheKey {
+        int downsample = 0;
+        float stepSize = 0.0f;
+        float maxDensity = 0.0f;  // Scales adaptive steps
+        float cutoff = 0.0f;
+        bool roulette = false;
+        StepMode stepMode = StepMode::Fixed;
+        SamplerMode samplerMode = SamplerMode::Nearest;
+        TraversalMode traversalMode = TraversalMode::FixedStep;
+        int bricks = -1;          // Brick encoding, -1 without a pool
+        
+        bool operator==(const LightCacheKey& o) const {
+            return std::tie(downsample, stepSize, maxDensity, cutoff, roulette, stepMode, samplerMode, traversalMode, bricks) ==
+                   std::tie(o.downsample, o.stepSize, o.maxDensity, o.cutoff, o.roulette, o.stepMode, o.samplerMode,
+                            o.traversalMode, o.bricks);
+        }
+    };
+    
+    // Frame-to-frame light cache updates, see setLightCacheReuse()
+    bool reuseLightCache = false;
+    float lightCacheTolerance = 1e-3f;
+    LightCacheKey lightCacheKey;
+    LightCacheUpdate lightCacheUpdate;
+    
+    // Change of each density leaf and tile, by origin, accumulated since
+    // the shadows through it were last marched; blocks without drift are absent
+    std::map<openvdb::Coord, float> lightCacheDrift;
+    
+    // Coarser density levels, 2x per level, and the footprint in voxels per unit distance
+    std::vector<openvdb::FloatGrid::Ptr> mipLevels;
+    float mipVoxelsPerT = 0.0f;
+    
+    // Dense reduced-precision copy of the density, see setBrickPool()
+    std::shared_ptr<const BrickPool> brickPool;
+    bool bakeBricks = false;
+    BrickEncoding brickEncoding = BrickEncoding::Half;
+    
+    void bindLevels(RenderContext& ctx) const {
+        ctx.levelAccessors.clear();
+        if (!hasMipLevels()) return;
+        ctx.levelAccessors.push_back(grid->getConstAccessor());
+        for (const openvdb::FloatGrid::Ptr& level : mipLevels) {
+            ctx.levelAccessors.push_back(level->getConstAccessor());
+        }
+    }
+    
+    // Let `sampler` pick mip levels from its ray footprint, no finer than
+    // minLevel, and read the brick pool at full resolution
+    void useLevels(RenderContext& ctx, RaySampler& sampler, float voxelsPerT, int minLevel = 0) const {
+        if (ctx.levelAccessors.size() > 1) {
+            sampler.setLevels(ctx.levelAccessors.data(), static_cast<int>(ctx.levelAccessors.size()),
+                              voxelsPerT, minLevel);
+        }
+        sampler.setBricks(brickPool.get());
+    }
+    
+    void updateBounds() {
+        bounds = grid->evalActiveVoxelBoundingBox();
+        
+        // Rays are in world space; cover the full extent of the edge voxels
+        openvdb::BBoxd indexBox(bounds.min().asVec3d() - openvdb::Vec3d(0.5),
+                                bounds.max().asVec3d() + openvdb::Vec3d(0.5));
+        openvdb::BBoxd world = grid->transform().indexToWorld(indexBox);
+        t0 = Vec3(world.min().x(), world.min().y(), world.min().z());
+        t1 = Vec3(world.max().x(), world.max().y(), world.max().z());
+    }
+    
+    // Whether a ray whose transmittance is `transmittance` keeps marching,
+    // playing Russian roulette below `threshold` when enabled
+    bool survives(float& transmittance, float threshold, RenderContext& ctx) const {
+        if (transmittance >= threshold) return true;
+        if (!roulette || transmittance <= 0.0f) return false;
+        
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        if (uniform(ctx.rng) * threshold < transmittance) {
+            transmittance = threshold;
+            return true;
+        }
+        transmittance = 0.0f;
+        return false;
+    }
+    
+    static openvdb::math::Ray<double> toVdbRay(const Vec3& origin, const Vec3& direction,
+                                              double tMax = std::numeric_limits<double>::max()) {
+        return openvdb::math::Ray<double>(openvdb::Vec3d(origin.x, origin.y, origin.z),
+                                          openvdb::Vec3d(direction.x, direction.y, direction.z),
+                                          0.0, tMax);
+    }
+    
+    // `channel` on the transform of `density`, resampled when it differs
+    static openvdb::FloatGrid::Ptr alignTo(const openvdb::FloatGrid& density, openvdb::FloatGrid::Ptr channel) {
+        if (channel->transform() == density.transform()) {
+            return channel;
+        }
+        openvdb::FloatGrid::Ptr aligned = openvdb::FloatGrid::create(channel->background());
+        aligned->setTransform(density.transform().copy());
+        openvdb::tools::resampleToMatch<openvdb::tools::BoxSampler>(*channel, *aligned);
+        return aligned;
+    }
+    
+    // Emitted radiance per unit length of one sampleChannels() result
+    Vec3 emission(const float* values) const {
+        float weight = flameGrid ? values[RaySampler::Flame] : values[RaySampler::Density];
+        if (weight <= 0.0f) {
+            return Vec3(0.0f);
+        }
+        float x = values[RaySampler::Temperature] * temperatureScale * ((BlackbodyTableSize - 1) / MaxBlackbodyKelvin);
+        x = std::min(std::max(x, 0.0f), BlackbodyTableSize - 1.0f);
+        int i = std::min(static_cast<int>(x), BlackbodyTableSize - 2);
+        float s = x - i;
+        Vec3 glow = blackbodyTable[i] + (blackbodyTable[i + 1] - blackbodyTable[i]) * s;
+        return glow * (weight * emissionScale);
+    }
+    
+    // World-space intervals of the ray worth integrating, into ctx.spans:
+    // the active node spans with hierarchical traversal, otherwise the
+    // clipped active bounding box. False if the ray misses the volume.
+    bool findSpans(const Ray& ray, RenderContext& ctx) const {
+        ctx.spans.clear();
+        
+        if (traversalMode == TraversalMode::Hierarchical) {
+            VolumeIntersector& isect = *ctx.intersector;
+            if (!isect.setWorldRay(toVdbRay(ray.origin, ray.direction))) {
+                return false;
+            }
+            isect.hits(ctx.spans);
+            for (RayTimeSpan& span : ctx.spans) {
+                span.set(isect.getWorldTime(span.t0), isect.getWorldTime(span.t1));
+            }
+            return !ctx.spans.empty();
+        }
+        
+        float tMin, tMax;
+        if (!intersectBox(ray, tMin, tMax)) {
+            return false;
+        }
+        ctx.spans.emplace_back(tMin, tMax);
+        return true;
+    }
+    
+    // Delta tracking over ctx.spans: free-flight distances are drawn against
+    // the majorant and a tentative collision is real with probability
+    // density / majorant. A real collision scores the in-scattered light
+    // there, whose expectation is the ray marcher's integral of
+    // T * density * phase * light, while only the collision points are ever
+    // sampled. Emission is scored as emission / majorant at every tentative
+    // collision up to the real one, which is T * emission in expectation.
+    // Free flight restarts at each span, which the exponential's
+    // memorylessness allows.
+    Vec3 deltaTrack(const Ray& ray, RenderContext& ctx) const {
+        Vec3 color(0.0f);
+        if (gridMaxDensity <= 0.0f) {
+            return color;
+        }
+        
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        float values[RaySampler::MaxChannels];
+        for (const RayTimeSpan& span : ctx.spans) {
+            float t = static_cast<float>(span.t0);
+            float tEnd = static_cast<float>(span.t1);
+            while (true) {
+                t -= std::log(1.0f - uniform(ctx.rng)) / gridMaxDensity;
+                if (t >= tEnd) break;
+                ++ctx.stats.primarySamples;
+                
+                float density;
+                if (hasEmission()) {
+                    ctx.primarySampler.sampleChannels(t, samplerMode, ctx.rng, values);
+                    density = values[RaySampler::Density];
+                    color = color + emission(values) / gridMaxDensity;
+                } else {
+                    density = ctx.primarySampler.sample(t, samplerMode, ctx.rng);
+                }
+                if (density <= 0.0f) ++ctx.stats.emptySamples;
+                
+                if (uniform(ctx.rng) * gridMaxDensity < density) {
+                    Vec3 pos = ray.origin + ray.direction * t;
+                    float phase = evalPhase(ray.direction.dot(lightDir));
+                    return color + Vec3(1.0f) * phase * lightTransmittance(ctx, pos, ctx.primarySampler.currentLevel());
+                }
+            }
+        }
+        return color;
+    }
+    
+    // Accumulate in-scattered and emitted light over [t, tEnd) until the
+    // ray saturates; false if it was terminated before tEnd. Runs the march
+    // kernel instantiated for the current sampler, phase function, shadow
+    // mode, emission and shadow timing.
+    bool marchSegment(const Ray& ray, float t, float tEnd, RenderContext& ctx,
+                      Vec3& color, float& transmittance) const {
+        return (this->*selectMarchKernel(ctx))(ray, t, tEnd, ctx, color, transmittance);
+    }
+    
+    using MarchKernel = bool (VolumeRenderer::*)(const Ray&, float, float, RenderContext&, Vec3&, float&) const;
+    
+    static constexpr size_t SamplerCount = std::tuple_size_v<SamplerPolicies>;
+    static constexpr size_t PhaseCount = std::tuple_size_v<PhasePolicies>;
+    static constexpr size_t ShadowCount = std::tuple_size_v<ShadowPolicies>;
+    static constexpr size_t EmissionCount = std::tuple_size_v<EmissionPolicies>;
+    static constexpr size_t InstrumentationCount = std::tuple_size_v<InstrumentationPolicies>;
+    static constexpr size_t MarchKernelCount = SamplerCount * PhaseCount * ShadowCount * EmissionCount * InstrumentationCount;
+    
+    // Kernel `I` of the dispatch table, the sampler varying fastest
+    template <size_t I>
+    static constexpr MarchKernel marchKernelAt() {
+        constexpr size_t phase = I / SamplerCount;
+        constexpr size_t shadow = phase / PhaseCount;
+        constexpr size_t emissive = shadow / ShadowCount;
+        constexpr size_t instrumentation = emissive / EmissionCount;
+        return &VolumeRenderer::marchKernel<std::tuple_element_t<I % SamplerCount, SamplerPolicies>,
+                                            std::tuple_element_t<phase % PhaseCount, PhasePolicies>,
+                                            std::tuple_element_t<shadow % ShadowCount, ShadowPolicies>,
+                                            std::tuple_element_t<emissive % EmissionCount, EmissionPolicies>,
+                                            std::tuple_element_t<instrumentation, InstrumentationPolicies>>;
+    }
+    
+    template <size_t... I>
+    static constexpr std::array<MarchKernel, sizeof...(I)> makeMarchKernels(std::index_sequence<I...>) {
+        return {{marchKernelAt<I>()...}};
+    }
+    
+    // Every combination of the policy axes, instantiated once
+    MarchKernel selectMarchKernel(const RenderContext& ctx) const {
+        static constexpr std::array<MarchKernel, MarchKernelCount> kernels =
+            makeMarchKernels(std::make_index_sequence<MarchKernelCount>());
+        
+        // A context made before the cache was baked has no accessor for it
+        ShadowMode shadows = shadowMode == ShadowMode::Cached && !ctx.lightCacheAccessor ? ShadowMode::Exact : shadowMode;
+        size_t i = static_cast<size_t>(ctx.timeShadows);
+        i = i * EmissionCount + static_cast<size_t>(hasEmission());
+        i = i * ShadowCount + static_cast<size_t>(shadows);
+        i = i * PhaseCount + static_cast<size_t>(phaseFunction);
+        i = i * SamplerCount + static_cast<size_t>(samplerMode);
+        return kernels[i];
+    }
+    
+    // The ray march with every mode fixed at compile time, so the inner
+    // loop carries no branches on them
+    template <class Sampling, class Phase, class Shadows, class Emission, class Instrumentation>
+    bool marchKernel(const Ray& ray, float t, float tEnd, RenderContext& ctx,
+                     Vec3& color, float& transmittance) const {
+        // A directional light scatters at a fixed angle along the ray
+        const float phase = Phase::eval(ray.direction.dot(lightDir), phaseG);
+        float values[RaySampler::MaxChannels];
+        while (t < tEnd && survives(transmittance, primaryCutoff, ctx)) {
+            Vec3 pos = ray.origin + ray.direction * t;
+            ++ctx.stats.primarySamples;
+            
+            // Get density, and temperature and flame when emitting, at current position
+            float density;
+            if constexpr (Emission::enabled) {
+                ctx.primarySampler.sampleChannels(t, Sampling::mode, ctx.rng, values);
+                density = values[RaySampler::Density];
+            } else {
+                density = ctx.primarySampler.sample(t, Sampling::mode, ctx.rng);
+            }
+            float dt = nextStep(ctx.primarySampler);
+            
+            if (density > 0.0f) {
+                // Calculate light contribution
+                float lightDensity = shadowTransmittance<Shadows, Instrumentation>(ctx, pos,
+                                                                                   ctx.primarySampler.currentLevel());
+                
+                // Beer's law for extinction
+                float extinction = density * dt;
+                transmittance *= std::exp(-extinction);
+                
+                // Add scattered light contribution
+                Vec3 scatteredLight = Vec3(1.0f) * phase * lightDensity;
+                color = color + scatteredLight * transmittance * extinction;
+            } else {
+                ++ctx.stats.emptySamples;
+            }
+            
+            if constexpr (Emission::enabled) {
+                color = color + emission(values) * (transmittance * dt);
+            }
+            
+            t += dt;
+        }
+        return t >= tEnd;
+    }
+    
+    // Phase function value for the current setting
+    float evalPhase(float cosTheta) const {
+        if (phaseFunction == PhaseFunction::HenyeyGreenstein) {
+            return HenyeyGreensteinPhase::eval(cosTheta, phaseG);
+        }
+        return IsotropicPhase::eval(cosTheta, phaseG);
+    }
+    
+    // First march sample at or after ray time t on the lattice of base steps
+    // from the ray origin. Spans start wherever the active bounds or nodes
+    // cut the ray, and those move with a clipped read (--crop, the frustum
+    // read), so snapping keeps every ray sampling at the same times however
+    // its volume was read.
+    float latticeStart(float t) const { return std::ceil(t / stepSize) * stepSize; }
+    
+    // Length of the next march step after a sample taken with `sampler`
+    // Coarser mip levels scale it by their voxel size.
+    float nextStep(const RaySampler& sampler) const {
+        float scale = sampler.stepScale();
+        if (stepMode == StepMode::Fixed) {
+            return stepSize * scale;
+        }
+        float blockMax = sampler.blockMaxDensity();
+        float stretched = blockMax <= 0.0f
+                        ? maxStepSize
+                        : std::min(std::max(stepSize * gridMaxDensity / blockMax, stepSize), maxStepSize);
+        
+        // The bound only holds inside the sample's block, so a stretched step
+        // ends at its exit and the next one takes the neighbour's bound
+        return std::max(std::min(stretched * scale, sampler.blockExit()), stepSize * scale);
+    }
+    
+    // Maximum of every leaf buffer: the same min/max pass analyze_vdb runs,
+    // but per leaf and in parallel. Inactive voxels count as well since the
+    // samplers read whole leaf buffers.
+    static std::vector<float> evalLeafMaxima(openvdb::tree::LeafManager<const openvdb::FloatTree>& leafs) {
+        std::vector<float> leafMaxValues(leafs.leafCount());
+        leafs.foreach([&](const openvdb::FloatTree::LeafNodeType& leaf, size_t n) {
+            float maxVal = std::numeric_limits<float>::lowest();
+            for (auto iter = leaf.cbeginValueAll(); iter; ++iter) {
+                maxVal = std::max(maxVal, *iter);
+            }
+            leafMaxValues[n] = maxVal;
+        });
+        return leafMaxValues;
+    }
+    
+    // Maximum over all leaf buffers and active tiles
+    float evalMaxDensity() const {
+        openvdb::tree::LeafManager<const openvdb::FloatTree> leafs(grid->tree());
+        float maxVal = 0.0f;
+        for (float leafMaxValue : evalLeafMaxima(leafs)) {
+            maxVal = std::max(maxVal, leafMaxValue);
+        }
+        
+        auto tileIter = grid->tree().cbeginValueOn();
+        tileIter.setMaxDepth(openvdb::FloatTree::ValueOnCIter::LEAF_DEPTH - 1);
+        for (; tileIter; ++tileIter) {
+            maxVal = std::max(maxVal, *tileIter);
+        }
+        return maxVal;
+    }
+    
+    // Per-leaf maximum density in a grid with one voxel per leaf
+    void buildLeafBounds() {
+        using LeafT = openvdb::FloatTree::LeafNodeType;
+        
+        openvdb::tree::LeafManager<const openvdb::FloatTree> leafs(grid->tree());
+        std::vector<float> leafMaxValues = evalLeafMaxima(leafs);
+        
+        leafMax = openvdb::FloatGrid::create(0.0f);
+        leafMax->setName("leaf_max_density");
+        openvdb::math::Transform::Ptr leafTransform = grid->transform().copy();
+        leafTransform->preScale(static_cast<double>(LeafT::DIM));
+        leafMax->setTransform(leafTransform);
+        
+        // Blocks without a leaf are bounded by their tile value in RaySampler
+        auto leafMaxAccessor = leafMax->getAccessor();
+        for (size_t n = 0; n < leafs.leafCount(); ++n) {
+            leafMaxAccessor.setValue(leafs.leaf(n).origin() >> LeafT::LOG2DIM, leafMaxValues[n]);
+        }
+        
+        // Never stride past the next leaf
+        maxStepSize = std::max(leafWidth(), stepSize);
+    }
+    
+    // World-space edge length of a density leaf
+    float leafWidth() const {
+        using LeafT = openvdb::FloatTree::LeafNodeType;
+        return static_cast<float>(grid->transform().voxelSize()[0] * LeafT::DIM);
+    }
+    
+    // Transmittance from a point toward the light, exact or cached; exact
+    // shadow rays sample from mip `level`
+    float lightTransmittance(RenderContext& ctx, const Vec3& pos, int level = 0) const {
+        if (!ctx.timeShadows) {
+            return evalLightTransmittance(ctx, pos, level);
+        }
+        auto start = std::chrono::steady_clock::now();
+        float transmittance = evalLightTransmittance(ctx, pos, level);
+        ctx.stats.shadowSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return transmittance;
+    }
+    
+    // lightTransmittance() without the shadow timer
+    float evalLightTransmittance(RenderContext& ctx, const Vec3& pos, int level) const {
+        using Untimed = InstrumentationPolicy<false>;
+        if (shadowMode == ShadowMode::None) {
+            return shadowTransmittance<ShadowPolicy<ShadowMode::None>, Untimed>(ctx, pos, level);
+        }
+        if (shadowMode == ShadowMode::Cached && ctx.lightCacheAccessor) {
+            return shadowTransmittance<ShadowPolicy<ShadowMode::Cached>, Untimed>(ctx, pos, level);
+        }
+        return shadowTransmittance<ShadowPolicy<ShadowMode::Exact>, Untimed>(ctx, pos, level);
+    }
+    
+    // Transmittance toward the light under a fixed shadow policy; cached
+    // shadows need a context holding a light cache accessor
+    template <class Shadows, class Instrumentation>
+    float shadowTransmittance(RenderContext& ctx, const Vec3& pos, int level) const {
+        if constexpr (Instrumentation::timeShadows) {
+            auto start = std::chrono::steady_clock::now();
+            float transmittance = shadowTransmittance<Shadows, InstrumentationPolicy<false>>(ctx, pos, level);
+            ctx.stats.shadowSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return transmittance;
+        } else if constexpr (Shadows::mode == ShadowMode::None) {
+            return 1.0f;
+        } else if constexpr (Shadows::mode == ShadowMode::Cached) {
+            ++ctx.stats.shadowSamples;
+            openvdb::Vec3d xyz = lightCache->transform().worldToIndex(openvdb::Vec3d(pos.x, pos.y, pos.z));
+            return openvdb::tools::BoxSampler::sample(*ctx.lightCacheAccessor, xyz);
+        } else {
+            return traceShadowRay(ctx, pos, integrator, level);
+        }
+    }
+    
+    LightCacheKey makeLightCacheKey(int downsample) const {
+        LightCacheKey key;
+        key.downsample = downsample;
+        key.stepSize = stepSize;
+        key.maxDensity = stepMode == StepMode::Adaptive ? gridMaxDensity : 0.0f;
+        key.cutoff = shadowCutoff;
+        key.roulette = roulette;
+        key.stepMode = stepMode;
+        key.samplerMode = samplerMode;
+        key.traversalMode = traversalMode;
+        key.bricks = brickPool ? static_cast<int>(brickPool->getEncoding()) : -1;
+        return key;
+    }
+    
+    // Bake one deterministic shadow march per voxel of a grid covering the density
+    // topology. The cache is dilated by one voxel so the trilinear lookup
+    // stays valid at the edges of the volume, and its background is 1
+    // (fully lit) everywhere outside it. Given the density of the frame the
+    // current cache was baked for, cache leaves away from the changes in
+    // density keep their previous values instead.
+    void buildLightCache(int downsample, const openvdb::FloatGrid* previousDensity = nullptr,
+                         const BrickPool* previousBricks = nullptr) {
+        auto start = std::chrono::steady_clock::now();
+        openvdb::FloatGrid::Ptr previousCache = previousDensity ? lightCache : nullptr;
+        lightCache.reset();
+        lightCacheUpdate = LightCacheUpdate();
+        openvdb::FloatGrid::Ptr cache = openvdb::FloatGrid::create(1.0f);
+        cache->setName("light_transmittance");
+        
+        openvdb::math::Transform::Ptr cacheTransform = grid->transform().copy();
+        if (downsample > 1) {
+            cacheTransform->preScale(static_cast<double>(downsample));
+        }
+        cache->setTransform(cacheTransform);
+        
+        // Activate every cache voxel overlapping an active density value
+        auto cacheAccessor = cache->getAccessor();
+        for (auto iter = grid->cbeginValueOn(); iter; ++iter) {
+            openvdb::CoordBBox bbox;
+            iter.getBoundingBox(bbox);
+            openvdb::Coord lo = openvdb::Coord::floor(bbox.min().asVec3d() / downsample);
+            openvdb::Coord hi = openvdb::Coord::floor(bbox.max().asVec3d() / downsample);
+            for (int x = lo.x(); x <= hi.x(); ++x) {
+                for (int y = lo.y(); y <= hi.y(); ++y) {
+                    for (int z = lo.z(); z <= hi.z(); ++z) {
+                        cacheAccessor.setValueOn(openvdb::Coord(x, y, z), 1.0f);
+                    }
+                }
+            }
+        }
+        openvdb::tools::dilateActiveValues(cache->tree(), 1, openvdb::tools::NN_FACE_EDGE_VERTEX);
+        cache->tree().voxelizeActiveTiles();
+        
+        // Cache leaves to march again when updating
+        ShadowedLeaves dirty;
+        if (!previousCache) {
+            lightCacheDrift.clear();
+        } else {
+            std::vector<openvdb::CoordBBox> regions = changedRegions(*previousDensity, previousBricks);
+            dirty = markShadowedLeaves(regions, *cache, downsample);
+            lightCacheUpdate.incremental = true;
+            lightCacheUpdate.changedRegions = regions.size();
+        }
+        
+        // March the shadow rays in parallel with one render context per leaf
+        // task; the cache is only published once it is complete. Voxels of a
+        // clean leaf that were already cached are copied over.
+        std::atomic<size_t> marched{0}, reused{0};
+        openvdb::tree::LeafManager<openvdb::FloatTree> leafs(cache->tree());
+        leafs.foreach([&](openvdb::FloatTree::LeafNodeType& leaf, size_t n) {
+            const openvdb::FloatTree::LeafNodeType* previous = nullptr;
+            if (previousCache && !dirty.contains(leaf.origin())) {
+                previous = previousCache->tree().probeConstLeaf(leaf.origin());
+            }
+            std::optional<RenderContext> ctx;
+            size_t leafMarched = 0, leafReused = 0;
+            for (auto iter = leaf.beginValueOn(); iter; ++iter) {
+                if (previous && previous->isValueOn(iter.pos())) {
+                    iter.setValue(previous->getValue(iter.pos()));
+                    ++leafReused;
+                    continue;
+                }
+                if (!ctx) ctx.emplace(makeContext(0, static_cast<uint32_t>(n)));
+                openvdb::Vec3d world = cacheTransform->indexToWorld(iter.getCoord());
+                Vec3 pos(static_cast<float>(world.x()), static_cast<float>(world.y()), static_cast<float>(world.z()));
+                iter.setValue(traceShadowRay(*ctx, pos, Integrator::RayMarch));
+                ++leafMarched;
+            }
+            marched += leafMarched;
+            reused += leafReused;
+        });
+        
+        lightCache = cache;
+        lightCacheKey = makeLightCacheKey(downsample);
+        lightCacheUpdate.marchedVoxels = marched;
+        lightCacheUpdate.reusedVoxels = reused;
+        lightCacheUpdate.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    
+    // Index-space boxes of the current density whose change since the
+    // shadows through them were last marched exceeds the reuse tolerance.
+    // Every leaf and active tile is compared with `before`, the previous
+    // frame, and its largest value difference is added to the drift it has
+    // accumulated in lightCacheDrift, so change spread over many frames is
+    // still caught; a reported block starts drifting from zero again.
+    // Leaves whose active states differ, leaves in only one of the grids and
+    // active tiles without a tile of the same size in the other grid are
+    // always reported. Released leaves (see BrickPool::releaseLeaves) are
+    // compared through both frames' bricks.
+    std::vector<openvdb::CoordBBox> changedRegions(const openvdb::FloatGrid& before, const BrickPool* beforeBricks) {
+        using LeafT = openvdb::FloatTree::LeafNodeType;
+        using TileIter = openvdb::FloatTree::ValueOnCIter;
+        const openvdb::FloatTree& after = grid->tree();
+        const float tolerance = lightCacheTolerance;
+        const float replaced = std::numeric_limits<float>::infinity();
+        
+        // Largest difference of every current leaf, infinite if its topology changed
+        std::vector<const LeafT*> leaves;
+        for (auto leaf = after.cbeginLeaf(); leaf; ++leaf) {
+            leaves.push_back(leaf.getLeaf());
+        }
+        std::vector<float> leafChange(leaves.size(), 0.0f);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, leaves.size()), [&](const tbb::blocked_range<size_t>& range) {
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                const LeafT* match = before.tree().probeConstLeaf(leaves[i]->origin());
+                if (!match || !leaves[i]->hasSameTopology(match)) {
+                    leafChange[i] = replaced;
+                    continue;
+                }
+                const float* a = leaves[i]->buffer().data();
+                const float* b = match->buffer().data();
+                float diff = 0.0f;
+                #pragma omp simd reduction(max:diff)
+                for (openvdb::Index j = 0; j < LeafT::SIZE; ++j) {
+                    diff = std::max(diff, std::abs(a[j] - b[j]));
+                }
+                leafChange[i] = diff;
+            }
+        });
+        
+        // Active tiles of one tree, matched against the other
+        struct TileValue {
+            openvdb::CoordBBox bbox;
+            float value;
+            openvdb::Index depth;
+        };
+        auto collectTiles = [](const openvdb::FloatTree& tree) {
+            std::vector<TileValue> tiles;
+            TileIter iter = tree.cbeginValueOn();
+            iter.setMaxDepth(TileIter::LEAF_DEPTH - 1);
+            for (; iter; ++iter) {
+                TileValue tile;
+                iter.getBoundingBox(tile.bbox);
+                tile.value = *iter;
+                tile.depth = iter.getDepth();
+                tiles.push_back(tile);
+            }
+            return tiles;
+        };
+        
+        // Largest difference of a current tile from the previous frame,
+        // infinite without a tile of the same depth there
+        auto tileChange = [&](const TileValue& tile) {
+            const openvdb::Coord& origin = tile.bbox.min();
+            float value;
+            if (!before.tree().probeValue(origin, value) ||
+                before.tree().getValueDepth(origin) != static_cast<int>(tile.depth)) {
+                return replaced;
+            }
+            float diff = std::abs(value - tile.value);
+            
+            // Leaf-sized tiles may stand for released leaves held as bricks
+            const BrickPool* mine = brickPool.get();
+            if (tile.depth != TileIter::LEAF_DEPTH - 1 || !mine || !beforeBricks) return diff;
+            uint32_t a = mine->find(origin), b = beforeBricks->find(origin);
+            if (a == BrickPool::Empty || b == BrickPool::Empty) return a == b ? diff : replaced;
+            BrickPool::Brick brickA = mine->brick(a), brickB = beforeBricks->brick(b);
+            for (int x = 0; x < BrickPool::Dim; ++x) {
+                for (int y = 0; y < BrickPool::Dim; ++y) {
+                    for (int z = 0; z < BrickPool::Dim; ++z) {
+                        int i = BrickPool::offset(x, y, z);
+                        diff = std::max(diff, std::abs(mine->decode(brickA, i) - beforeBricks->decode(brickB, i)));
+                    }
+                }
+            }
+            return diff;
+        };
+        std::vector<TileValue> tiles = collectTiles(after);
+        std::vector<float> tileChanges(tiles.size(), 0.0f);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles.size()), [&](const tbb::blocked_range<size_t>& range) {
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                tileChanges[i] = tileChange(tiles[i]);
+            }
+        });
+        
+        // Accumulate the drift of every current block; blocks that are gone
+        // from the current frame drop out of the map
+        std::vector<openvdb::CoordBBox> regions;
+        std::map<openvdb::Coord, float> drift;
+        auto accumulate = [&](const openvdb::CoordBBox& bbox, float change) {
+            auto previous = lightCacheDrift.find(bbox.min());
+            float total = change + (previous != lightCacheDrift.end() ? previous->second : 0.0f);
+            if (total > tolerance) {
+                regions.push_back(bbox);
+            } else if (total > 0.0f) {
+                drift.emplace(bbox.min(), total);
+            }
+        };
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            accumulate(leaves[i]->getNodeBoundingBox(), leafChange[i]);
+        }
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            accumulate(tiles[i].bbox, tileChanges[i]);
+        }
+        lightCacheDrift = std::move(drift);
+        
+        // Blocks of the previous frame that the current one lacks
+        for (auto leaf = before.tree().cbeginLeaf(); leaf; ++leaf) {
+            if (!after.probeConstLeaf(leaf->origin())) regions.push_back(leaf->getNodeBoundingBox());
+        }
+        std::vector<TileValue> beforeTiles = collectTiles(before.tree());
+        std::vector<char> gone(beforeTiles.size(), 0);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, beforeTiles.size()), [&](const tbb::blocked_range<size_t>& range) {
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                const openvdb::Coord& origin = beforeTiles[i].bbox.min();
+                float value;
+                gone[i] = !after.probeValue(origin, value) ||
+                          after.getValueDepth(origin) != static_cast<int>(beforeTiles[i].depth);
+            }
+        });
+        for (size_t i = 0; i < beforeTiles.size(); ++i) {
+            if (gone[i]) regions.push_back(beforeTiles[i].bbox);
+        }
+        return regions;
+    }
+    
+    // Flags over the leaves of the cache bounding box, x-major, of the
+    // leaves holding a voxel whose shadow ray can read density from one of
+    // `regions`. Shadow rays run toward the light, so each region, padded
+    // for the sampling stencil and the sweep step, is swept away from the
+    // light across the cache in steps of half a leaf.
+    struct ShadowedLeaves {
+        openvdb::Coord min, dims;  // In leaves
+        std::vector<char> flags;
+        
+        bool contains(const openvdb::Coord& origin) const {
+            openvdb::Coord b = (origin >> openvdb::FloatTree::LeafNodeType::LOG2DIM) - min;
+            return flags[(static_cast<size_t>(b.x()) * dims.y() + b.y()) * dims.z() + b.z()] != 0;
+        }
+    };
+    
+    ShadowedLeaves markShadowedLeaves(const std::vector<openvdb::CoordBBox>& regions, const openvdb::FloatGrid& cache,
+                                      int downsample) const {
+        using LeafT = openvdb::FloatTree::LeafNodeType;
+        const openvdb::math::Transform& xform = cache.transform();
+        openvdb::Vec3d zero = xform.worldToIndex(openvdb::Vec3d(0.0));
+        openvdb::Vec3d away = zero - xform.worldToIndex(openvdb::Vec3d(lightDir.x, lightDir.y, lightDir.z));
+        away.normalize();
+        
+        openvdb::CoordBBox cacheBox = cache.evalActiveVoxelBoundingBox();
+        ShadowedLeaves shadowed;
+        if (cacheBox.empty()) return shadowed;
+        shadowed.min = cacheBox.min() >> LeafT::LOG2DIM;
+        shadowed.dims = (cacheBox.max() >> LeafT::LOG2DIM) - shadowed.min + openvdb::Coord(1);
+        shadowed.flags.assign(static_cast<size_t>(shadowed.dims.x()) * shadowed.dims.y() * shadowed.dims.z(), 0);
+        
+        const double step = 0.5 * LeafT::DIM;
+        const int pad = static_cast<int>(std::ceil(0.5 * step)) + 2;
+        const int steps = static_cast<int>(std::ceil((cacheBox.max() - cacheBox.min()).asVec3d().length() / step)) + 1;
+        for (const openvdb::CoordBBox& region : regions) {
+            // Cache index space, as when the cache topology is activated
+            openvdb::Coord lo = openvdb::Coord::floor(region.min().asVec3d() / downsample) - openvdb::Coord(pad);
+            openvdb::Coord hi = openvdb::Coord::floor(region.max().asVec3d() / downsample) + openvdb::Coord(pad);
+            bool entered = false;
+            for (int k = 0; k <= steps; ++k) {
+                openvdb::Coord shift = openvdb::Coord::round(away * (k * step));
+                openvdb::CoordBBox box(lo + shift, hi + shift);
+                box.intersect(cacheBox);
+                if (box.empty()) {
+                    if (entered) break;  // The sweep has left the cache for good
+                    continue;
+                }
+                entered = true;
+                
+                openvdb::Coord b0 = (box.min() >> LeafT::LOG2DIM) - shadowed.min;
+                openvdb::Coord b1 = (box.max() >> LeafT::LOG2DIM) - shadowed.min;
+                for (int x = b0.x(); x <= b1.x(); ++x) {
+                    for (int y = b0.y(); y <= b1.y(); ++y) {
+                        char* row = shadowed.flags.data() + (static_cast<size_t>(x) * shadowed.dims.y() + y) * shadowed.dims.z();
+                        std::fill(row + b0.z(), row + b1.z() + 1, 1);
+                    }
+                }
+            }
+        }
+        return shadowed;
+    }
+    
+    bool intersectBox(const Ray& ray, float& tMin, float& tMax) const {
+        Vec3 invDir(1.0f/ray.direction.x, 1.0f/ray.direction.y, 1.0f/ray.direction.z);
+        Vec3 tMin3 = (t0 - ray.origin).componentMul(invDir);
+        Vec3 tMax3 = (t1 - ray.origin).componentMul(invDir);
+        
+        Vec3 t1 = Vec3::max(tMin3, tMax3);
+        Vec3 t2 = Vec3::min(tMin3, tMax3);
+        
+        tMin = std::max(std::max(t2.x, t2.y), t2.z);
+        tMax = std::min(std::min(t1.x, t1.y), t1.z);
+        
+        return tMax >= tMin && tMax > 0;
+    }
+    
+    // Slab test for every lane of a packet; `alive` is 1 for lanes that are
+    // valid and hit the box, 0 otherwise
+    void intersectBoxPacket(const RayPacket& packet, float* tMin, float* tMax, float* alive) const {
+        #pragma omp simd
+        for (int i = 0; i < PacketSize; ++i) {
+            float ix = 1.0f / packet.dx[i], iy = 1.0f / packet.dy[i], iz = 1.0f / packet.dz[i];
+            float ax = (t0.x - packet.ox[i]) * ix, bx = (t1.x - packet.ox[i]) * ix;
+            float ay = (t0.y - packet.oy[i]) * iy, by = (t1.y - packet.oy[i]) * iy;
+            float az = (t0.z - packet.oz[i]) * iz, bz = (t1.z - packet.oz[i]) * iz;
+            
+            tMin[i] = std::max(std::max(std::min(ax, bx), std::min(ay, by)), std::min(az, bz));
+            tMax[i] = std::min(std::min(std::max(ax, bx), std::max(ay, by)), std::max(az, bz));
+            
+            bool hit = i < packet.count && tMax[i] >= tMin[i] && tMax[i] > 0.0f;
+            alive[i] = hit ? 1.0f : 0.0f;
+        }
+    }
+    
+    // Transmittance toward the light, marched or ratio-tracked per `method`
+    float traceShadowRay(RenderContext& ctx, const Vec3& pos, Integrator method, int level = 0) const {
+        // Only the stretch inside the volume bounds can attenuate
+        float tMin, tMax;
+        float transmittance = 1.0f;
+        ++ctx.stats.shadowRays;
+        if (!intersectBox(Ray(pos, lightDir), tMin, tMax)) {
+            return transmittance;
+        }
+        const float tStart = latticeStart(std::max(tMin, 0.0f));
+        
+        ctx.shadowSampler.reset(ctx.stats, ctx.densityAccessor, grid->transform(), pos, lightDir,
+                                ctx.leafMaxAccessor.get());
+        useLevels(ctx, ctx.shadowSampler, 0.0f, level);
+        
+        auto segment = [&](float t, float tEnd) {
+            if (method == Integrator::DeltaTracking) {
+                return ratioTrackShadowSegment(ctx, t, tEnd, transmittance);
+            }
+            return marchShadowSegment(ctx, t, tEnd, transmittance);
+        };
+        
+        if (traversalMode == TraversalMode::Hierarchical) {
+            VolumeIntersector& isect = *ctx.intersector;
+            if (!isect.setWorldRay(toVdbRay(pos, lightDir, tMax))) {
+                return transmittance;
+            }
+            
+            double it0, it1;
+            while (isect.march(it0, it1)) {
+                if (!survives(transmittance, shadowCutoff, ctx) ||
+                    !segment(latticeStart(static_cast<float>(isect.getWorldTime(it0))),
+                             static_cast<float>(isect.getWorldTime(it1)))) {
+                    ++ctx.stats.terminatedShadowRays;
+                    break;
+                }
+            }
+            return transmittance;
+        }
+        
+        if (!segment(tStart, tMax)) ++ctx.stats.terminatedShadowRays;
+        return transmittance;
+    }
+    
+    // Ratio tracking: every tentative collision against the majorant scales
+    // the transmittance by the probability of it being a null collision.
+    // Both shadow segment walks return false if terminated before tEnd.
+    bool ratioTrackShadowSegment(RenderContext& ctx, float t, float tEnd, float& transmittance) const {
+        if (gridMaxDensity <= 0.0f) return true;
+        
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        while (survives(transmittance, shadowCutoff, ctx)) {
+            t -= std::log(1.0f - uniform(ctx.rng)) / gridMaxDensity;
+            if (t >= tEnd) break;
+            ++ctx.stats.shadowSamples;
+            float density = ctx.shadowSampler.sample(t, samplerMode, ctx.rng);
+            if (density <= 0.0f) ++ctx.stats.emptyShadowSamples;
+            transmittance *= 1.0f - std::min(density, gridMaxDensity) / gridMaxDensity;
+        }
+        return t >= tEnd;
+    }
+    
+    bool marchShadowSegment(RenderContext& ctx, float t, float tEnd, float& transmittance) const {
+        while (t < tEnd && survives(transmittance, shadowCutoff, ctx)) {
+            ++ctx.stats.shadowSamples;
+            float density = ctx.shadowSampler.sample(t, samplerMode, ctx.rng);
+            if (density <= 0.0f) ++ctx.stats.emptyShadowSamples;
+            float dt = nextStep(ctx.shadowSampler);
+            transmittance *= std::exp(-density * dt);
+            t += dt;
+        }
+        return t >= tEnd;
+    }
+};
+
+// Screen-space block of pixels scheduled as one unit of work, [x0, x1) x [y0, y1)
+struct Tile {
+    int x0, y0, x1, y1;
+};
+
+// Split a region of the frame into tiles ordered by distance from the
+// region centre, so the tiles most likely to cover the dense core of the
+// volume start first
+inline std::vector<Tile> makeTiles(const Tile& region, int tileSize) {
+    std::vector<Tile> tiles;
+    for (int y = region.y0; y < region.y1; y += tileSize) {
+        for (int x = region.x0; x < region.x1; x += tileSize) {
+            tiles.push_back({x, y, std::min(x + tileSize, region.x1), std::min(y + tileSize, region.y1)});
+        }
+    }
+    
+    auto centreDistance = [&](const Tile& tile) {
+        float dx = 0.5f * (tile.x0 + tile.x1) - 0.5f * (region.x0 + region.x1);
+        float dy = 0.5f * (tile.y0 + tile.y1) - 0.5f * (region.y0 + region.y1);
+        return dx * dx + dy * dy;
+    };
+    std::stable_sort(tiles.begin(), tiles.end(), [&](const Tile& a, const Tile& b) {
+        return centreDistance(a) < centreDistance(b);
+    });
+    return tiles;
+}
+
+inline std::vector<Tile> makeTiles(int width, int height, int tileSize) {
+    return makeTiles(Tile{0, 0, width, height}, tileSize);
+}
+
+// Trace every pixel of a tile. With a one-channel `cost` image, each
+// pixel's primary and shadow sample count is added to it. Frame pixel
+// (x, y) is stored at (x - originX, y - originY) of both images.
+inline void renderTile(const VolumeRenderer& renderer, const Camera& camera, int width, int height,
+                       const Tile& tile, RenderContext& ctx, Image& image, Image* cost = nullptr,
+                       int originX = 0, int originY = 0) {
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        float* out = image.pixel(tile.x0 - originX, y - originY);
+        for (int x = tile.x0; x < tile.x1; ++x, out += 3) {
+            float u = (x + 0.5f) / width;
+            float v = 1.0f - (y + 0.5f) / height;  // Rows run top to bottom
+            
+            uint64_t samples = ctx.stats.samples();
+            Ray ray = camera.getRay(u, v);
+            Vec3 color = renderer.trace(ray, ctx);
+            out[0] = color.x;
+            out[1] = color.y;
+            out[2] = color.z;
+            if (cost) {
+                *cost->pixel(x - originX, y - originY) += static_cast<float>(ctx.stats.samples() - samples);
+            }
+        }
+    }
+}
+
+// Packet variant of renderTile: each tile row is covered by runs of
+// PacketSize horizontally adjacent, highly coherent primary rays. Lanes
+// are traced together, so a packet's cost is split evenly between them.
+inline void renderTilePackets(const VolumeRenderer& renderer, const Camera& camera, int width, int height,
+                              const Tile& tile, RenderContext& ctx, Image& image, Image* cost = nullptr,
+                              int originX = 0, int originY = 0) {
+    RayPacket packet;
+    Vec3 colors[PacketSize];
+    
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; x += PacketSize) {
+            packet.count = std::min(PacketSize, tile.x1 - x);
+            for (int i = 0; i < PacketSize; ++i) {
+                // Pad unused lanes with the last valid ray so they stay finite
+                int lane = std::min(i, packet.count - 1);
+                float u = (x + lane + 0.5f) / width;
+                float v = 1.0f - (y + 0.5f) / height;  // Rows run top to bottom
+                
+                Ray ray = camera.getRay(u, v);
+                packet.ox[i] = ray.origin.x;
+                packet.oy[i] = ray.origin.y;
+                packet.oz[i] = ray.origin.z;
+                packet.dx[i] = ray.direction.x;
+                packet.dy[i] = ray.direction.y;
+                packet.dz[i] = ray.direction.z;
+            }
+            
+            uint64_t samples = ctx.stats.samples();
+            renderer.tracePacket(packet, ctx, colors);
+            float* out = image.pixel(x - originX, y - originY);
+            for (int i = 0; i < packet.count; ++i, out += 3) {
+                out[0] = colors[i].x;
+                out[1] = colors[i].y;
+                out[2] = colors[i].z;
+            }
+            if (cost) {
+                float laneCost = static_cast<float>(ctx.stats.samples() - samples) / packet.count;
+                for (int i = 0; i < packet.count; ++i) {
+                    *cost->pixel(x + i - originX, y - originY) += laneCost;
+                }
+            }
+        }
+    }
+}
+
+// Per-thread render contexts; a pool outliving one frame keeps the
+// accessors, scratch buffers and random streams across frames and passes
+using ContextPool = tbb::enumerable_thread_specific<RenderContext>;
+
+// Render the crop window `region` of a width x height frame into `pixels`
+// and `cost`, which are sized to the region, with one task per worker slot
+// and one render context per worker thread. Workers pull tiles from a shared
+// counter in the centre-first order of the tile list, so the expensive
+// centre tiles start first and the cheap border tiles are what is left to
+// balance at the end. Rays are
+// those of the full frame, and marches start on a lattice independent of
+// the volume bounds (see VolumeRenderer::latticeStart), so crops assemble
+// into the frame rendered whole even from clipped reads.
+inline void renderRegion(const VolumeRenderer& renderer, const Camera& camera, int width, int height,
+                         const Tile& region, Image& pixels, ContextPool& contexts, int tileSize = 16,
+                         bool packets = false, Image* cost = nullptr) {
+    std::vector<Tile> tiles = makeTiles(region, tileSize);
+    
+    // Splitting the tile list itself would hand stolen halves out from the
+    // middle of the priority order, so each slot claims the next tile instead
+    std::atomic<size_t> nextTile{0};
+    const int slots = std::max(1, std::min(tbb::this_task_arena::max_concurrency(), static_cast<int>(tiles.size())));
+    tbb::parallel_for(tbb::blocked_range<int>(0, slots, 1),
+        [&](const tbb::blocked_range<int>&) {
+            RenderContext& ctx = contexts.local();
+            for (size_t i = nextTile++; i < tiles.size(); i = nextTile++) {
+                if (packets) {
+                    renderTilePackets(renderer, camera, width, height, tiles[i], ctx, pixels, cost,
+                                      region.x0, region.y0);
+                } else {
+                    renderTile(renderer, camera, width, height, tiles[i], ctx, pixels, cost, region.x0, region.y0);
+                }
+            }
+        }, tbb::simple_partitioner());
+}
+
+// Render the full frame
+inline void renderImage(const VolumeRenderer& renderer, const Camera& camera, int width, int height,
+                        Image& pixels, ContextPool& contexts, int tileSize = 16, bool packets = false,
+                        Image* cost = nullptr) {
+    renderRegion(renderer, camera, width, height, Tile{0, 0, width, height}, pixels, contexts, tileSize, packets, cost);
+}
+
+inline void renderImage(const VolumeRenderer& renderer, const Camera& camera, int width, int height,
+                        Image& pixels, uint32_t seed, int tileSize = 16, bool packets = false) {
+    std::atomic<uint32_t> nextStream{0};
+    ContextPool contexts([&] {
+        return renderer.makeContext(seed, nextStream++);
+    });
+    renderImage(renderer, camera, width, height, pixels, contexts, tileSize, packets);
+}
+
+// Sum of the counters of every context in the pool, which are reset so
+// the next call covers only the work done since
+inline RenderStats collectStats(ContextPool& contexts) {
+    RenderStats total;
+    for (RenderContext& ctx : contexts) {
+        total.merge(ctx.stats);
+        ctx.stats = RenderStats();
+    }
+    return total;
+}
+
+// False-color RGB rendering of a one-channel cost image, black through
+// purple, red and yellow to white at `maxCost`; 0 scales to the largest
+// cost in the image
+inline Image costHeatmap(const Image& cost, float maxCost = 0.0f) {
+    const int width = cost.getWidth(), height = cost.getHeight();
+    const size_t n = static_cast<size_t>(width) * height;
+    Image heatmap(width, height);
+    if (n == 0) return heatmap;
+    if (maxCost <= 0.0f) {
+        maxCost = *std::max_element(cost.data(), cost.data() + n);
+    }
+    if (!(maxCost > 0.0f)) {
+        maxCost = 1.0f;  // An all-zero map stays at the bottom of the ramp
+    }
+    
+    const Vec3 ramp[] = {Vec3(0.0f), Vec3(0.35f, 0.0f, 0.55f), Vec3(0.9f, 0.15f, 0.1f),
+                         Vec3(1.0f, 0.85f, 0.0f), Vec3(1.0f)};
+    const int segments = sizeof(ramp) / sizeof(ramp[0]) - 1;
+    
+    for (size_t i = 0; i < n; ++i) {
+        float x = std::min(std::max(cost.data()[i] / maxCost, 0.0f), 1.0f) * segments;
+        int k = std::min(static_cast<int>(x), segments - 1);
+        Vec3 color = ramp[k] + (ramp[k + 1] - ramp[k]) * (x - k);
+        heatmap.data()[3 * i] = color.x;
+        heatmap.data()[3 * i + 1] = color.y;
+        heatmap.data()[3 * i + 2] = color.z;
+    }
+    return heatmap;
+}
+
+#endif // VOLUME_RENDERER_H
@@ -1,10 +1,20 @@
 #include <openvdb/openvdb.h>
+#include <openvdb/tree/LeafManager.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
 #include <iostream>
+#include <iomanip>
 #include <string>
 #include <limits>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <cstdint>
+
+#include "ImageIO.h"
 
 // Structure to hold RGB color
 struct Color {
@@ -44,50 +54,421 @@ Color valueToColor(float value, float minVal, float maxVal) {
 
 // Function to save a 2D slice as PPM image
 void saveSliceToPPM(const std::string& filename, const std::vector<Color>& pixels, int width, int height) {
-    std::ofstream file(filename, std::ios::binary);
-    file << "P6\n" << width << " " << height << "\n255\n";
-    for (const auto& color : pixels) {
-        file.write(reinterpret_cast<const char*>(&color.r), 1);
-        file.write(reinterpret_cast<const char*>(&color.g), 1);
-        file.write(reinterpret_cast<const char*>(&color.b), 1);
+    static_assert(sizeof(Color) == 3, "Color must be packed 8-bit RGB");
+    ImageIO::savePPM(filename, reinterpret_cast<const unsigned char*>(pixels.data()), width, height);
+}
+
+// Scalar components of a grid value, so one statistics template covers
+// scalar and vector grids. Components are promoted to double, which holds
+// float, double and int32 values exactly.
+template<typename T>
+struct ValueComponents {
+    static constexpr int Size = 1;
+    static double get(const T& value, int) { return static_cast<double>(value); }
+};
+
+template<typename T>
+struct ValueComponents<openvdb::math::Vec3<T>> {
+    static constexpr int Size = 3;
+    static double get(const openvdb::math::Vec3<T>& value, int c) { return static_cast<double>(value[c]); }
+};
+
+// Statistics of one value component over the active voxels of a grid
+struct ComponentStats {
+    double count = 0.0;
+    double sum = 0.0;
+    double sumSq = 0.0;
+    double nonZero = 0.0;
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+    std::vector<uint64_t> histogram;
+    
+    double mean() const { return count > 0.0 ? sum / count : 0.0; }
+    double stddev() const {
+        if (count <= 0.0) return 0.0;
+        double m = mean();
+        return std::sqrt(std::max(sumSq / count - m * m, 0.0));
+    }
+    
+    void merge(const ComponentStats& other) {
+        count += other.count;
+        sum += other.sum;
+        sumSq += other.sumSq;
+        nonZero += other.nonZero;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        histogram.resize(std::max(histogram.size(), other.histogram.size()), 0);
+        for (size_t i = 0; i < other.histogram.size(); ++i) {
+            histogram[i] += other.histogram[i];
+        }
+    }
+};
+
+// Moments of the active values of one leaf buffer. Inactive voxels take
+// neutral values through selects instead of branches, so each component's
+// loop over the 512 values vectorizes. Sums and extremes are kept in double
+// so large or integer values keep their precision.
+template<typename LeafT>
+void reduceLeaf(const LeafT& leaf, std::vector<ComponentStats>& stats) {
+    using Components = ValueComponents<typename LeafT::ValueType>;
+    const typename LeafT::ValueType* values = leaf.buffer().data();
+    
+    alignas(32) float active[LeafT::SIZE];
+    for (openvdb::Index i = 0; i < LeafT::SIZE; ++i) {
+        active[i] = leaf.getValueMask().isOn(i) ? 1.0f : 0.0f;
+    }
+    
+    for (int c = 0; c < Components::Size; ++c) {
+        double minVal = std::numeric_limits<double>::max();
+        double maxVal = std::numeric_limits<double>::lowest();
+        double sum = 0.0, sumSq = 0.0;
+        float nonZero = 0.0f, count = 0.0f;
+        #pragma omp simd reduction(min:minVal) reduction(max:maxVal) reduction(+:sum, sumSq, nonZero, count)
+        for (openvdb::Index i = 0; i < LeafT::SIZE; ++i) {
+            double v = Components::get(values[i], c);
+            bool on = active[i] > 0.0f;
+            minVal = std::min(minVal, on ? v : std::numeric_limits<double>::max());
+            maxVal = std::max(maxVal, on ? v : std::numeric_limits<double>::lowest());
+            double w = on ? v : 0.0;
+            sum += w;
+            sumSq += w * w;
+            nonZero += on && v != 0.0 ? 1.0f : 0.0f;
+            count += active[i];
+        }
+        stats[c].count += count;
+        stats[c].sum += sum;
+        stats[c].sumSq += sumSq;
+        stats[c].nonZero += nonZero;
+        stats[c].min = std::min(stats[c].min, minVal);
+        stats[c].max = std::max(stats[c].max, maxVal);
+    }
+}
+
+// Per-component statistics of the active values of a grid: moments and
+// range in one parallel pass over the leaves, then a `bins`-bin histogram
+// over that range in a second. Active tiles count once per voxel covered.
+template<typename GridT>
+std::vector<ComponentStats> evalStatistics(const GridT& grid, int bins) {
+    using TreeT = typename GridT::TreeType;
+    using LeafT = typename TreeT::LeafNodeType;
+    using Components = ValueComponents<typename GridT::ValueType>;
+    
+    openvdb::tree::LeafManager<const TreeT> leafs(grid.tree());
+    const std::vector<ComponentStats> empty(Components::Size);
+    auto join = [](std::vector<ComponentStats> a, const std::vector<ComponentStats>& b) {
+        for (size_t c = 0; c < a.size(); ++c) a[c].merge(b[c]);
+        return a;
+    };
+    
+    std::vector<ComponentStats> stats = tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, leafs.leafCount()), empty,
+        [&](const tbb::blocked_range<size_t>& range, std::vector<ComponentStats> partial) {
+            for (size_t n = range.begin(); n != range.end(); ++n) {
+                reduceLeaf(leafs.leaf(n), partial);
+            }
+            return partial;
+        }, join);
+    
+    // Active tiles above the leaf level
+    auto tileIter = grid.tree().cbeginValueOn();
+    tileIter.setMaxDepth(TreeT::ValueOnCIter::LEAF_DEPTH - 1);
+    for (; tileIter; ++tileIter) {
+        double voxels = static_cast<double>(tileIter.getVoxelCount());
+        for (int c = 0; c < Components::Size; ++c) {
+            double v = Components::get(*tileIter, c);
+            stats[c].count += voxels;
+            stats[c].sum += voxels * v;
+            stats[c].sumSq += voxels * v * v;
+            stats[c].nonZero += v != 0.0 ? voxels : 0.0;
+            stats[c].min = std::min(stats[c].min, v);
+            stats[c].max = std::max(stats[c].max, v);
+        }
+    }
+    
+    if (bins <= 0) {
+        return stats;
+    }
+    
+    // Histogram over each component's range
+    auto binOf = [&](double v, int c) {
+        double range = stats[c].max - stats[c].min;
+        int bin = range > 0.0 ? static_cast<int>((v - stats[c].min) / range * bins) : 0;
+        return std::min(std::max(bin, 0), bins - 1);
+    };
+    std::vector<ComponentStats> counted(Components::Size);
+    for (ComponentStats& component : counted) {
+        component.histogram.assign(bins, 0);
+    }
+    counted = tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, leafs.leafCount()), counted,
+        [&](const tbb::blocked_range<size_t>& range, std::vector<ComponentStats> partial) {
+            for (size_t n = range.begin(); n != range.end(); ++n) {
+                const LeafT& leaf = leafs.leaf(n);
+                for (auto iter = leaf.cbeginValueOn(); iter; ++iter) {
+                    for (int c = 0; c < Components::Size; ++c) {
+                        ++partial[c].histogram[binOf(Components::get(*iter, c), c)];
+                    }
+                }
+            }
+            return partial;
+        }, join);
+    
+    tileIter = grid.tree().cbeginValueOn();
+    tileIter.setMaxDepth(TreeT::ValueOnCIter::LEAF_DEPTH - 1);
+    for (; tileIter; ++tileIter) {
+        for (int c = 0; c < Components::Size; ++c) {
+            counted[c].histogram[binOf(Components::get(*tileIter, c), c)] += tileIter.getVoxelCount();
+        }
+    }
+    for (int c = 0; c < Components::Size; ++c) {
+        stats[c].histogram = counted[c].histogram;
+    }
+    return stats;
+}
+
+// Print the statistics of each component, labelled x/y/z for vector grids
+void printStatistics(const std::vector<ComponentStats>& stats) {
+    const char* labels[] = {"x", "y", "z"};
+    for (size_t c = 0; c < stats.size(); ++c) {
+        const ComponentStats& s = stats[c];
+        std::cout << "\nValue Statistics";
+        if (stats.size() > 1) std::cout << " (" << labels[c % 3] << ")";
+        std::cout << ":" << std::endl;
+        if (s.count <= 0.0) {
+            std::cout << "No active values" << std::endl;
+            continue;
+        }
+        std::cout << "Min value: " << s.min << std::endl;
+        std::cout << "Max value: " << s.max << std::endl;
+        std::cout << "Mean: " << s.mean() << std::endl;
+        std::cout << "Std deviation: " << s.stddev() << std::endl;
+        std::cout << "Non-zero fraction: " << (s.count > 0.0 ? s.nonZero / s.count : 0.0) << std::endl;
+        
+        if (s.histogram.empty()) continue;
+        std::cout << "Histogram:" << std::endl;
+        uint64_t peak = *std::max_element(s.histogram.begin(), s.histogram.end());
+        double width = (s.max - s.min) / s.histogram.size();
+        for (size_t i = 0; i < s.histogram.size(); ++i) {
+            int bar = peak > 0 ? static_cast<int>(40 * s.histogram[i] / peak) : 0;
+            std::cout << "  [" << std::setw(10) << s.min + width * i << ", " << std::setw(10) << s.min + width * (i + 1)
+                      << ") " << std::setw(12) << s.histogram[i] << " " << std::string(bar, '#') << std::endl;
+        }
     }
 }
 
-// Function to create a slice visualization
-void visualizeGridSlice(openvdb::FloatGrid::Ptr grid, const std::string& name, 
-                       const openvdb::CoordBBox& bbox, float minVal, float maxVal) {
-    // Get the dimensions of the bounding box
+// Which planes visualizeGridSlices cuts through a grid
+struct SliceOptions {
+    int axis = 2;           // Plane normal: 0 = x, 1 = y, 2 = z
+    bool hasIndex = false;  // Cut at `index` rather than the middle of the bbox
+    int index = 0;
+    int count = 1;          // Number of planes spread evenly across the bbox
+    bool contactSheet = false;
+};
+
+// Heat-map images of the planes `planes[s]` normal to `axis`, each covering
+// bbox in the other two axes (u = the lower, v = the higher). Leaves are
+// visited in parallel and each writes the 8x8 pixels it covers in every
+// plane it crosses, so leaves away from the planes cost nothing and empty
+// space is never visited. Tiles fill their footprint, the rest is background.
+std::vector<std::vector<Color>> extractSlices(const openvdb::FloatGrid& grid, const openvdb::CoordBBox& bbox,
+                                              int axis, const std::vector<int>& planes,
+                                              float minVal, float maxVal) {
+    using LeafT = openvdb::FloatTree::LeafNodeType;
+    const int u = axis == 0 ? 1 : 0;
+    const int v = axis == 2 ? 1 : 2;
     openvdb::Coord dims = bbox.max() - bbox.min() + openvdb::Coord(1);
-    int width = dims.x();
-    int height = dims.y();
+    const int width = dims[u];
+    const int height = dims[v];
     
-    // Create accessor for efficient value access
-    auto accessor = grid->getConstAccessor();
+    std::vector<std::vector<Color>> images(planes.size(),
+        std::vector<Color>(width * height, valueToColor(grid.background(), minVal, maxVal)));
     
-    // Create pixel buffer
-    std::vector<Color> pixels(width * height);
+    // Fill the part of `box` inside bbox on every plane it crosses
+    auto fillBox = [&](const openvdb::CoordBBox& box, float value) {
+        Color color = valueToColor(value, minVal, maxVal);
+        int u0 = std::max(box.min()[u], bbox.min()[u]), u1 = std::min(box.max()[u], bbox.max()[u]);
+        int v0 = std::max(box.min()[v], bbox.min()[v]), v1 = std::min(box.max()[v], bbox.max()[v]);
+        for (size_t s = 0; s < planes.size(); ++s) {
+            if (planes[s] < box.min()[axis] || planes[s] > box.max()[axis]) continue;
+            for (int y = v0; y <= v1; ++y) {
+                for (int x = u0; x <= u1; ++x) {
+                    images[s][(y - bbox.min()[v]) * width + (x - bbox.min()[u])] = color;
+                }
+            }
+        }
+    };
     
-    // Get the middle Z coordinate for the slice
-    int midZ = (bbox.min().z() + bbox.max().z()) / 2;
+    auto tileIter = grid.tree().cbeginValueAll();
+    tileIter.setMaxDepth(openvdb::FloatTree::ValueAllCIter::LEAF_DEPTH - 1);
+    for (; tileIter; ++tileIter) {
+        openvdb::CoordBBox box;
+        tileIter.getBoundingBox(box);
+        fillBox(box, *tileIter);
+    }
     
-    // Fill the pixel buffer
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            openvdb::Coord xyz(x + bbox.min().x(), y + bbox.min().y(), midZ);
-            float value = accessor.getValue(xyz);
-            pixels[y * width + x] = valueToColor(value, minVal, maxVal);
+    // Leaves cover disjoint pixels, so they need no synchronisation
+    openvdb::tree::LeafManager<const openvdb::FloatTree> leafs(grid.tree());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, leafs.leafCount()),
+        [&](const tbb::blocked_range<size_t>& range) {
+            for (size_t n = range.begin(); n != range.end(); ++n) {
+                const LeafT& leaf = leafs.leaf(n);
+                const openvdb::Coord& origin = leaf.origin();
+                for (size_t s = 0; s < planes.size(); ++s) {
+                    if (planes[s] < origin[axis] || planes[s] >= origin[axis] + static_cast<int>(LeafT::DIM)) continue;
+                    
+                    openvdb::Coord xyz;
+                    xyz[axis] = planes[s];
+                    for (int j = 0; j < static_cast<int>(LeafT::DIM); ++j) {
+                        xyz[v] = origin[v] + j;
+                        if (xyz[v] < bbox.min()[v] || xyz[v] > bbox.max()[v]) continue;
+                        for (int i = 0; i < static_cast<int>(LeafT::DIM); ++i) {
+                            xyz[u] = origin[u] + i;
+                            if (xyz[u] < bbox.min()[u] || xyz[u] > bbox.max()[u]) continue;
+                            images[s][(xyz[v] - bbox.min()[v]) * width + (xyz[u] - bbox.min()[u])] =
+                                valueToColor(leaf.getValue(xyz), minVal, maxVal);
+                        }
+                    }
+                }
+            }
+        });
+    
+    return images;
+}
+
+// Function to create slice visualizations: the middle-Z plane by default,
+// or any axis, plane and number of planes, saved one image per plane or
+// tiled into one contact sheet
+void visualizeGridSlices(openvdb::FloatGrid::Ptr grid, const std::string& name, const openvdb::CoordBBox& bbox,
+                         float minVal, float maxVal, const SliceOptions& options) {
+    const int axis = options.axis;
+    const int u = axis == 0 ? 1 : 0;
+    const int v = axis == 2 ? 1 : 2;
+    openvdb::Coord dims = bbox.max() - bbox.min() + openvdb::Coord(1);
+    const int width = dims[u];
+    const int height = dims[v];
+    const char axisName = "xyz"[axis];
+    
+    // Planes to cut: the requested or middle one, or `count` spread evenly
+    std::vector<int> planes;
+    int lo = bbox.min()[axis], hi = bbox.max()[axis];
+    if (options.count <= 1) {
+        planes.push_back(options.hasIndex ? options.index : (lo + hi) / 2);
+    } else {
+        for (int s = 0; s < options.count; ++s) {
+            planes.push_back(lo + static_cast<int>((hi - lo) * (s + 0.5) / options.count));
+        }
+    }
+    
+    std::vector<std::vector<Color>> images = extractSlices(*grid, bbox, axis, planes, minVal, maxVal);
+    
+    if (options.contactSheet && images.size() > 1) {
+        // Tile the planes row by row with a one-pixel black border
+        int cols = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(images.size()))));
+        int rows = static_cast<int>((images.size() + cols - 1) / cols);
+        int sheetWidth = cols * (width + 1) + 1;
+        int sheetHeight = rows * (height + 1) + 1;
+        std::vector<Color> sheet(sheetWidth * sheetHeight);
+        for (size_t s = 0; s < images.size(); ++s) {
+            int x0 = 1 + static_cast<int>(s % cols) * (width + 1);
+            int y0 = 1 + static_cast<int>(s / cols) * (height + 1);
+            for (int y = 0; y < height; ++y) {
+                std::copy(images[s].begin() + y * width, images[s].begin() + (y + 1) * width,
+                          sheet.begin() + (y0 + y) * sheetWidth + x0);
+            }
         }
+        
+        std::string filename = name + "_slices_" + axisName + ".ppm";
+        saveSliceToPPM(filename, sheet, sheetWidth, sheetHeight);
+        std::cout << "Saved " << images.size() << "-slice contact sheet to " << filename << std::endl;
+        return;
     }
     
-    // Save the image
-    std::string filename = name + "_slice.ppm";
-    saveSliceToPPM(filename, pixels, width, height);
-    std::cout << "Saved visualization to " << filename << std::endl;
+    for (size_t s = 0; s < images.size(); ++s) {
+        // Keep the original name for the default middle-Z slice
+        bool defaultSlice = axis == 2 && !options.hasIndex && options.count <= 1;
+        std::string filename = defaultSlice ? name + "_slice.ppm"
+                                            : name + "_slice_" + axisName + std::to_string(planes[s]) + ".ppm";
+        saveSliceToPPM(filename, images[s], width, height);
+        std::cout << "Saved visualization to " << filename << std::endl;
+    }
+}
+
+// Print the statistics the file stores for a grid, available without
+// reading any voxels. Files written without them leave these keys out.
+void printFileMetadata(const openvdb::GridBase& grid) {
+    std::cout << "\nStored Metadata:" << std::endl;
+    if (grid[openvdb::GridBase::META_FILE_VOXEL_COUNT]) {
+        std::cout << "Active voxel count: "
+                  << grid.metaValue<openvdb::Int64>(openvdb::GridBase::META_FILE_VOXEL_COUNT) << std::endl;
+    }
+    if (grid[openvdb::GridBase::META_FILE_MEM_BYTES]) {
+        std::cout << "Memory usage (bytes): "
+                  << grid.metaValue<openvdb::Int64>(openvdb::GridBase::META_FILE_MEM_BYTES) << std::endl;
+    }
+    if (grid[openvdb::GridBase::META_FILE_BBOX_MIN] && grid[openvdb::GridBase::META_FILE_BBOX_MAX]) {
+        std::cout << "Min voxel index: "
+                  << grid.metaValue<openvdb::Vec3i>(openvdb::GridBase::META_FILE_BBOX_MIN) << std::endl;
+        std::cout << "Max voxel index: "
+                  << grid.metaValue<openvdb::Vec3i>(openvdb::GridBase::META_FILE_BBOX_MAX) << std::endl;
+    }
+}
+
+// Parse all of `text` as a number for `option`, reporting it when it is
+// not one or is out of range
+template<typename T>
+bool parseNumber(const std::string& option, const std::string& text, T& value) {
+    std::istringstream stream(text);
+    if (stream >> value && (stream >> std::ws).eof()) return true;
+    std::cerr << "Invalid value for " << option << ": " << text << std::endl;
+    return false;
 }
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cout << "Usage: " << argv[0] << " <vdb_file>" << std::endl;
+    bool metadataOnly = false;
+    int histogramBins = 16;
+    SliceOptions sliceOptions;
+    std::string filename;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--metadata-only") {
+            metadataOnly = true;
+        } else if (arg == "--bins" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], histogramBins)) return 1;
+        } else if (arg == "--slice-axis" && i + 1 < argc) {
+            std::string axis = argv[++i];
+            if (axis != "x" && axis != "y" && axis != "z") {
+                std::cerr << "Unknown slice axis: " << axis << " (expected x, y or z)" << std::endl;
+                return 1;
+            }
+            sliceOptions.axis = axis == "x" ? 0 : axis == "y" ? 1 : 2;
+        } else if (arg == "--slice-index" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], sliceOptions.index)) return 1;
+            sliceOptions.hasIndex = true;
+        } else if (arg == "--slices" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], sliceOptions.count)) return 1;
+            sliceOptions.count = std::max(sliceOptions.count, 1);
+        } else if (arg == "--contact-sheet") {
+            sliceOptions.contactSheet = true;
+        } else if (filename.empty() && arg[0] != '-') {
+            filename = arg;
+        } else {
+            filename.clear();
+            break;
+        }
+    }
+    if (filename.empty()) {
+        std::cout << "Usage: " << argv[0] << " [options] <vdb_file>" << std::endl;
+        std::cout << "  --metadata-only     Print stored metadata without reading voxels" << std::endl;
+        std::cout << "  --bins N            Histogram bins, 0 to skip (default: 16)" << std::endl;
+        std::cout << "  --slice-axis x|y|z  Normal of the slice planes (default: z)" << std::endl;
+        std::cout << "  --slice-index N     Cut at voxel index N instead of the middle" << std::endl;
+        std::cout << "  --slices N          Cut N planes spread evenly across the grid" << std::endl;
+        std::cout << "  --contact-sheet     Tile the planes into one image per grid" << std::endl;
+        return 1;
+    }
+    if (sliceOptions.hasIndex && sliceOptions.count > 1) {
+        std::cerr << "--slice-index cuts a single plane and cannot be combined with --slices " << sliceOptions.count
+                  << std::endl;
         return 1;
     }
 
@@ -95,33 +476,43 @@ int main(int argc, char** argv) {
     openvdb::initialize();
     
     try {
-        std::string filename = argv[1];
         std::cout << "\nAnalyzing VDB file: " << filename << std::endl;
         std::cout << std::string(50, '=') << std::endl;
 
-        // Open the VDB file
+        // Open the VDB file delay-loaded and without a private copy, so
+        // only the grids and leaf buffers actually inspected are paged in
         openvdb::io::File file(filename);
-        file.open();
+        file.setCopyMaxBytes(0);
+        file.open(true);
 
-        // Get grid metadata
-        openvdb::GridPtrVecPtr grids = file.getGrids();
+        // Get grid metadata, transforms included, without reading any trees
+        openvdb::GridPtrVecPtr grids = file.readAllGridMetadata();
 
         std::cout << "\nFile Information:" << std::endl;
         std::cout << "Number of grids: " << grids->size() << std::endl;
 
         // Analyze each grid
-        for (openvdb::GridBase::Ptr grid : *grids) {
-            std::cout << "\nGrid: " << grid->getName() << std::endl;
+        for (openvdb::GridBase::Ptr metaGrid : *grids) {
+            std::cout << "\nGrid: " << metaGrid->getName() << std::endl;
             std::cout << std::string(30, '-') << std::endl;
 
             // Grid type and other basic info
-            std::cout << "Grid type: " << grid->type() << std::endl;
-            std::cout << "Value type: " << grid->valueType() << std::endl;
-            std::cout << "Class: " << grid->getGridClass() << std::endl;
+            std::cout << "Grid type: " << metaGrid->type() << std::endl;
+            std::cout << "Value type: " << metaGrid->valueType() << std::endl;
+            std::cout << "Class: " << metaGrid->getGridClass() << std::endl;
             
             // Get transform info
-            openvdb::math::Transform::Ptr transform = grid->transformPtr();
+            openvdb::math::Transform::Ptr transform = metaGrid->transformPtr();
             std::cout << "Voxel size: " << transform->voxelSize()[0] << std::endl;
+            
+            printFileMetadata(*metaGrid);
+            if (metadataOnly) {
+                std::cout << std::endl << std::string(50, '=') << std::endl;
+                continue;
+            }
+            
+            // Read the grid itself for the statistics below
+            openvdb::GridBase::Ptr grid = file.readGrid(metaGrid->getName());
 
             // Get grid statistics
             std::cout << "\nGrid Statistics:" << std::endl;
@@ -145,60 +536,38 @@ int main(int argc, char** argv) {
             std::cout << "\nValue at origin (0,0,0):" << std::endl;
             std::cout << "Voxel index: " << originCoord << std::endl;
 
-            // Try to cast to specific grid types for more information
+            // Grid type-specific statistics, one template for every value type
+            auto analyze = [&](const auto& typedGrid) {
+                auto accessor = typedGrid.getConstAccessor();
+                std::cout << "Value at origin: " << accessor.getValue(originCoord) << std::endl;
+                std::vector<ComponentStats> stats = evalStatistics(typedGrid, histogramBins);
+                printStatistics(stats);
+                return stats;
+            };
+            
             if (auto floatGrid = openvdb::GridBase::grid<openvdb::FloatGrid>(grid)) {
                 std::cout << "\nFloat Grid Statistics:" << std::endl;
-                float minVal = std::numeric_limits<float>::max();
-                float maxVal = std::numeric_limits<float>::lowest();
-                
-                // Check value at origin
-                auto accessor = floatGrid->getConstAccessor();
-                float originValue = accessor.getValue(originCoord);
-                std::cout << "Value at origin: " << originValue << std::endl;
-                
-                // Find min/max values
-                for (auto iter = floatGrid->beginValueOn(); iter; ++iter) {
-                    float val = *iter;
-                    minVal = std::min(minVal, val);
-                    maxVal = std::max(maxVal, val);
-                }
-                
-                std::cout << "\nValue Statistics:" << std::endl;
-                std::cout << "Min value: " << minVal << std::endl;
-                std::cout << "Max value: " << maxVal << std::endl;
+                std::vector<ComponentStats> stats = analyze(*floatGrid);
 
-                // Create visualization
-                visualizeGridSlice(floatGrid, grid->getName(), bbox, minVal, maxVal);
+                // Create visualization; an empty grid has an inverted bbox and nothing to cut
+                if (bbox.empty() || stats[0].count <= 0.0) {
+                    std::cout << "No active voxels to slice" << std::endl;
+                } else {
+                    visualizeGridSlices(floatGrid, grid->getName(), bbox, static_cast<float>(stats[0].min),
+                                        static_cast<float>(stats[0].max), sliceOptions);
+                }
+            }
+            else if (auto doubleGrid = openvdb::GridBase::grid<openvdb::DoubleGrid>(grid)) {
+                std::cout << "\nDouble Grid Statistics:" << std::endl;
+                analyze(*doubleGrid);
+            }
+            else if (auto intGrid = openvdb::GridBase::grid<openvdb::Int32Grid>(grid)) {
+                std::cout << "\nInt32 Grid Statistics:" << std::endl;
+                analyze(*intGrid);
             }
             else if (auto vec3Grid = openvdb::GridBase::grid<openvdb::Vec3SGrid>(grid)) {
                 std::cout << "\nVector Grid detected" << std::endl;
-                
-                // Check value at origin
-                auto accessor = vec3Grid->getConstAccessor();
-                openvdb::Vec3f originValue = accessor.getValue(originCoord);
-                std::cout << "Value at origin: " << originValue << std::endl;
-                
-                openvdb::Vec3f minVal(std::numeric_limits<float>::max());
-                openvdb::Vec3f maxVal(std::numeric_limits<float>::lowest());
-                
-                // Find min/max values
-                for (auto iter = vec3Grid->beginValueOn(); iter; ++iter) {
-                    openvdb::Vec3f val = *iter;
-                    minVal = openvdb::Vec3f(
-                        std::min(minVal[0], val[0]),
-                        std::min(minVal[1], val[1]),
-                        std::min(minVal[2], val[2])
-                    );
-                    maxVal = openvdb::Vec3f(
-                        std::max(maxVal[0], val[0]),
-                        std::max(maxVal[1], val[1]),
-                        std::max(maxVal[2], val[2])
-                    );
-                }
-                
-                std::cout << "\nValue Statistics:" << std::endl;
-                std::cout << "Min values (x,y,z): " << minVal << std::endl;
-                std::cout << "Max values (x,y,z): " << maxVal << std::endl;
+                analyze(*vec3Grid);
             }
 
             std::cout << std::endl << std::string(50, '=') << std::endl;
@@ -0,0 +1,242 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+#ifdef WITH_OPENEXR
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfInputFile.h>
+#endif
+
+#include "ImageIO.h"
+
+// Assemble crop windows rendered by volume_render --crop / --crop-grid,
+// possibly on different machines, into the full frame. Each crop carries
+// its placement: PPM crops in their "# crop" comment, EXR crops in their
+// data and display windows.
+
+// One crop as read from disk; PPM crops keep their 8-bit values so the
+// merged frame is byte-identical to the crops
+struct Crop {
+    CropInfo info;
+    int width = 0, height = 0;
+    std::vector<unsigned char> rgb;
+    std::vector<float> pixels;
+};
+
+// Whether a crop has positive dimensions and lies inside a frame of
+// positive size, so its placement can be allocated and copied safely
+bool checkPlacement(const std::string& filename, const Crop& crop) {
+    const CropInfo& info = crop.info;
+    if (info.fullWidth > 0 && info.fullHeight > 0 && crop.width > 0 && crop.height > 0 && info.x >= 0 &&
+        info.y >= 0 && static_cast<int64_t>(info.x) + crop.width <= info.fullWidth &&
+        static_cast<int64_t>(info.y) + crop.height <= info.fullHeight) {
+        return true;
+    }
+    std::cerr << "Error: " << filename << " is a " << crop.width << "x" << crop.height << " crop at " << info.x << ","
+              << info.y << ", which does not fit a " << info.fullWidth << "x" << info.fullHeight << " frame"
+              << std::endl;
+    return false;
+}
+
+// Read a binary P6 file and the crop comment in its header
+bool readPPM(const std::string& filename, Crop& crop) {
+    std::ifstream file(filename, std::ios::binary);
+    std::string magic;
+    if (!file || !(file >> magic) || magic != "P6") {
+        std::cerr << "Error: " << filename << " is not a binary PPM" << std::endl;
+        return false;
+    }
+    
+    // Width, height and maximum value, with comments allowed in between
+    int header[3];
+    bool placed = false;
+    for (int& value : header) {
+        while (file >> std::ws && file.peek() == '#') {
+            std::string comment;
+            std::getline(file, comment);
+            CropInfo& info = crop.info;
+            if (std::sscanf(comment.c_str(), "# crop %d %d %d %d", &info.x, &info.y, &info.fullWidth,
+                            &info.fullHeight) == 4) {
+                placed = true;
+            }
+        }
+        if (!(file >> value)) {
+            std::cerr << "Error: Bad PPM header in " << filename << std::endl;
+            return false;
+        }
+    }
+    if (header[2] != 255) {
+        std::cerr << "Error: " << filename << " is not an 8-bit PPM" << std::endl;
+        return false;
+    }
+    if (!placed) {
+        std::cerr << "Error: " << filename << " has no crop placement; render it with --crop or --crop-grid" << std::endl;
+        return false;
+    }
+    
+    crop.width = header[0];
+    crop.height = header[1];
+    if (!checkPlacement(filename, crop)) {
+        return false;
+    }
+    crop.rgb.resize(static_cast<size_t>(crop.width) * crop.height * 3);
+    file.get();  // The single whitespace byte before the raster
+    file.read(reinterpret_cast<char*>(crop.rgb.data()), static_cast<std::streamsize>(crop.rgb.size()));
+    if (!file) {
+        std::cerr << "Error: " << filename << " is truncated" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Read the RGB channels of a float EXR, placed by its data window
+bool readEXR(const std::string& filename, Crop& crop) {
+#ifdef WITH_OPENEXR
+    try {
+        Imf::InputFile file(filename.c_str());
+        const Imath::Box2i& data = file.header().dataWindow();
+        const Imath::Box2i& display = file.header().displayWindow();
+        crop.info = {data.min.x - display.min.x, data.min.y - display.min.y,
+                     display.max.x - display.min.x + 1, display.max.y - display.min.y + 1};
+        crop.width = data.max.x - data.min.x + 1;
+        crop.height = data.max.y - data.min.y + 1;
+        if (!checkPlacement(filename, crop)) {
+            return false;
+        }
+        crop.pixels.assign(static_cast<size_t>(crop.width) * crop.height * 3, 0.0f);
+        
+        // Slices are addressed in data window coordinates
+        const size_t xStride = sizeof(float) * 3;
+        const size_t yStride = xStride * crop.width;
+        const ptrdiff_t origin = static_cast<ptrdiff_t>(data.min.x * xStride + data.min.y * yStride);
+        const char* names[] = {"R", "G", "B"};
+        Imf::FrameBuffer frameBuffer;
+        for (int c = 0; c < 3; ++c) {
+            char* base = reinterpret_cast<char*>(crop.pixels.data() + c) - origin;
+            frameBuffer.insert(names[c], Imf::Slice(Imf::FLOAT, base, xStride, yStride));
+        }
+        file.setFrameBuffer(frameBuffer);
+        file.readPixels(data.min.y, data.max.y);
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: Could not read " << filename << ": " << e.what() << std::endl;
+        return false;
+    }
+#else
+    (void)crop;
+    std::cerr << "Error: Built without OpenEXR, cannot read " << filename << std::endl;
+    return false;
+#endif
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [-o output] <crop> [<crop> ...]" << std::endl;
+    std::cout << "Assembles crops from volume_render --crop / --crop-grid into the full frame." << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  -o FILE   Merged frame (default: volume_render.ppm, or .exr for EXR crops)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string output;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    // Crops are all PPM or all EXR, taken from the first one
+    const bool exr = ImageIO::isEXR(inputs.front());
+    if (output.empty()) {
+        output = exr ? "volume_render.exr" : "volume_render.ppm";
+    }
+    if (!exr && ImageIO::isEXR(output)) {
+        std::cerr << "Error: 8-bit PPM crops cannot be merged into an EXR" << std::endl;
+        return 1;
+    }
+    
+    int width = 0, height = 0;
+    std::vector<unsigned char> rgb;
+    std::vector<float> pixels;
+    std::vector<uint8_t> covered;
+    size_t overlaps = 0, merged = 0;
+    for (const std::string& input : inputs) {
+        if (ImageIO::isEXR(input) != exr) {
+            std::cerr << "Error: " << input << " mixes PPM and EXR crops" << std::endl;
+            return 1;
+        }
+        // A crop that cannot be read or placed is reported and left out
+        Crop crop;
+        if (!(exr ? readEXR(input, crop) : readPPM(input, crop))) {
+            std::cerr << "Skipping " << input << std::endl;
+            continue;
+        }
+        
+        const CropInfo& info = crop.info;
+        if (width == 0) {
+            width = info.fullWidth;
+            height = info.fullHeight;
+            rgb.assign(exr ? 0 : static_cast<size_t>(width) * height * 3, 0);
+            pixels.assign(exr ? static_cast<size_t>(width) * height * 3 : 0, 0.0f);
+            covered.assign(static_cast<size_t>(width) * height, 0);
+        }
+        if (info.fullWidth != width || info.fullHeight != height) {
+            std::cerr << "Error: " << input << " is a crop of a " << info.fullWidth << "x" << info.fullHeight
+                      << " frame, not " << width << "x" << height << "; skipping it" << std::endl;
+            continue;
+        }
+        ++merged;
+        
+        // Copy the crop row by row into place
+        for (int y = 0; y < crop.height; ++y) {
+            const size_t src = static_cast<size_t>(y) * crop.width;
+            const size_t dst = static_cast<size_t>(info.y + y) * width + info.x;
+            if (exr) {
+                std::copy_n(crop.pixels.data() + src * 3, crop.width * 3, pixels.data() + dst * 3);
+            } else {
+                std::copy_n(crop.rgb.data() + src * 3, crop.width * 3, rgb.data() + dst * 3);
+            }
+            for (int x = 0; x < crop.width; ++x) {
+                overlaps += covered[dst + x];
+                covered[dst + x] = 1;
+            }
+        }
+    }
+    
+    if (merged == 0) {
+        std::cerr << "Error: No crop could be merged" << std::endl;
+        return 1;
+    }
+    
+    size_t missing = std::count(covered.begin(), covered.end(), 0);
+    if (missing > 0 || overlaps > 0) {
+        std::cerr << "Warning: " << missing << " pixels not covered by any crop, " << overlaps
+                  << " covered more than once" << std::endl;
+    }
+    
+    bool saved = exr ? ImageIO::save(output, pixels.data(), width, height)
+                     : ImageIO::savePPM(output, rgb.data(), width, height);
+    if (!saved) {
+        return 1;
+    }
+    std::cout << "Merged " << merged << " crops into " << width << "x" << height << " " << output << std::endl;
+    return 0;
+}
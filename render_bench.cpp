@@ -0,0 +1,525 @@
+#include <openvdb/openvdb.h>
+#include <tbb/global_control.h>
+#include <omp.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "VolumeRenderer.h"
+#include "scene.h"
+
+static_assert(RenderStatsEnabled, "render_bench reports the hot-path counters; build it with VOLUME_RENDER_STATS=1");
+
+// Wall-clock time of the render stages of one configuration, in ms. The
+// shadow time of a frame is the thread time spent in shadow evaluation,
+// divided by the thread count, and march is the rest of the frame.
+struct StageTimes {
+    double load = 0.0;
+    double accel = 0.0;
+    double march = 0.0;
+    double shadow = 0.0;
+    double output = 0.0;
+};
+
+// One benchmarked configuration
+struct BenchResult {
+    std::string scene;
+    std::string storage = "vdb";
+    int width = 0;
+    int height = 0;
+    float stepSize = 0.0f;   // 0 for the ground scene
+    int threads = 0;
+    int frames = 0;
+    double msPerFrame = 0.0; // Median over the timed frames
+    double raysPerSecond = 0.0;
+    double samplesPerSecond = 0.0;
+    double lookupsPerRay = 0.0;
+    
+    // Fractions of the timed frames' work, from the hot-path counters
+    double emptySamples = 0.0;   // Primary and shadow samples with no density
+    double terminatedRays = 0.0; // Primary rays cut off by the transmittance threshold
+    double blockHits = 0.0;      // Lookups inside the sampler's previous block
+    double accessorHits = 0.0;   // Block changes whose leaf the accessor had cached
+    StageTimes stages;
+};
+
+struct BenchOptions {
+    std::vector<std::string> scenes;
+    std::vector<std::pair<int, int>> sizes = {{320, 240}, {800, 600}};
+    std::vector<float> steps = {0.1f, 0.05f};
+    std::vector<int> threads;
+    std::vector<std::string> storage = {"vdb"};
+    int repeats = 3;
+    bool costMaps = false;
+    std::string vdbFile;
+    std::string gridName = "density";
+    std::string jsonFile;
+    ShadowMode shadowMode = ShadowMode::Exact;
+    TraversalMode traversalMode = TraversalMode::FixedStep;
+};
+
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+double timeMs(F&& f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+// Procedural stand-in for an explosion: a ball of smoke fading out
+// radially, broken up by a few octaves of sine noise so rays see both
+// dense and thin regions. Deterministic, so runs stay comparable.
+openvdb::FloatGrid::Ptr makeSyntheticExplosion(int radius, double voxelSize) {
+    openvdb::FloatGrid::Ptr grid = openvdb::FloatGrid::create(0.0f);
+    grid->setName("density");
+    grid->setTransform(openvdb::math::Transform::createLinearTransform(voxelSize));
+    
+    auto accessor = grid->getAccessor();
+    const float invRadius = 1.0f / radius;
+    for (int z = -radius; z <= radius; ++z) {
+        for (int y = -radius; y <= radius; ++y) {
+            for (int x = -radius; x <= radius; ++x) {
+                float r = std::sqrt(static_cast<float>(x * x + y * y + z * z)) * invRadius;
+                if (r >= 1.0f) continue;
+                
+                float noise = 0.0f, amplitude = 0.5f, frequency = 4.0f * invRadius;
+                for (int octave = 0; octave < 3; ++octave) {
+                    noise += amplitude * std::sin(x * frequency + 1.3f * octave) *
+                             std::sin(y * frequency * 1.1f + 0.7f) * std::sin(z * frequency * 0.9f + 2.1f);
+                    amplitude *= 0.5f;
+                    frequency *= 2.0f;
+                }
+                float falloff = 1.0f - r * r;
+                float density = falloff * (0.6f + noise);
+                if (density > 0.0f) {
+                    accessor.setValue(openvdb::Coord(x, y, z), 2.0f * density);
+                }
+            }
+        }
+    }
+    return grid;
+}
+
+openvdb::FloatGrid::Ptr loadDensity(const std::string& path, const std::string& gridName) {
+    openvdb::io::File file(path);
+    file.open();
+    openvdb::FloatGrid::Ptr grid = openvdb::gridPtrCast<openvdb::FloatGrid>(file.readGrid(gridName));
+    file.close();
+    if (!grid) {
+        throw std::runtime_error("Grid " + gridName + " in " + path + " is not a float grid");
+    }
+    return grid;
+}
+
+// Camera looking at the centre of the grid's active region from the same
+// direction as volume_render's default view, far enough to frame it
+Camera frameGrid(const openvdb::FloatGrid& grid, float aspect) {
+    openvdb::CoordBBox bbox = grid.evalActiveVoxelBoundingBox();
+    openvdb::BBoxd world = grid.transform().indexToWorld(bbox);
+    openvdb::Vec3d centre = world.getCenter();
+    float radius = static_cast<float>(0.5 * (world.max() - world.min()).length());
+    
+    Vec3 target(static_cast<float>(centre.x()), static_cast<float>(centre.y()), static_cast<float>(centre.z()));
+    Vec3 position = target + Vec3(5.0f, 3.0f, 5.0f).normalized() * (2.5f * radius);
+    return Camera(position, target, Vec3(0.0f, 1.0f, 0.0f), 60.0f, aspect);
+}
+
+void benchVolume(const std::string& scene, openvdb::FloatGrid::Ptr grid, double loadMs,
+                 const BenchOptions& options, std::vector<BenchResult>& results) {
+    const Vec3 lightDir(-1.0f, 1.0f, -1.0f);
+    std::unique_ptr<VolumeRenderer> renderer;
+    StageTimes setup;
+    setup.load = loadMs;
+    setup.accel = timeMs([&] {
+        renderer = std::make_unique<VolumeRenderer>(grid, lightDir, options.steps.front());
+        renderer->setTraversalMode(options.traversalMode);
+    });
+    
+    for (const std::string& storage : options.storage) {
+        // Brick pools are rebuilt for every frame, so their bake counts as acceleration setup
+        StageTimes stages = setup;
+        stages.accel += timeMs([&] {
+            if (storage == "vdb") {
+                renderer->setBrickPool(false);
+            } else {
+                renderer->setBrickPool(true, storage == "u16" ? BrickEncoding::UInt16
+                                           : storage == "u8" ? BrickEncoding::UInt8 : BrickEncoding::Half);
+            }
+        });
+        
+        for (auto [width, height] : options.sizes) {
+            Camera camera = frameGrid(*grid, static_cast<float>(width) / height);
+            Image image(width, height);
+            
+            for (float step : options.steps) {
+                // The light cache is baked with the step size, so it is part of
+                // the shadow stage rather than the renderer setup
+                renderer->setStepSize(step);
+                double bakeMs = timeMs([&] { renderer->setShadowMode(options.shadowMode); });
+                
+                for (int threads : options.threads) {
+                    tbb::global_control parallelism(tbb::global_control::max_allowed_parallelism, threads);
+                    std::atomic<uint32_t> nextStream{0};
+                    ContextPool contexts([&] {
+                        return renderer->makeContext(1234u, nextStream++);
+                    });
+                    
+                    // Warm up the contexts' accessor caches, then time the frames
+                    renderImage(*renderer, camera, width, height, image, contexts);
+                    collectStats(contexts);
+                    
+                    std::vector<double> frameMs;
+                    RenderStats work;
+                    for (int i = 0; i < options.repeats; ++i) {
+                        frameMs.push_back(timeMs([&] { renderImage(*renderer, camera, width, height, image, contexts); }));
+                        work.merge(collectStats(contexts));
+                    }
+                    
+                    // One more frame with the shadow timers on for the stage split,
+                    // which also records the cost map
+                    Image cost(width, height, 1);
+                    Image* costImage = options.costMaps ? &cost : nullptr;
+                    for (RenderContext& ctx : contexts) ctx.timeShadows = true;
+                    double profiledMs = timeMs([&] {
+                        renderImage(*renderer, camera, width, height, image, contexts, 16, false, costImage);
+                    });
+                    for (RenderContext& ctx : contexts) ctx.timeShadows = false;
+                    RenderStats profiled = collectStats(contexts);
+                    
+                    BenchResult result;
+                    result.scene = scene;
+                    result.storage = storage;
+                    result.width = width;
+                    result.height = height;
+                    result.stepSize = step;
+                    result.threads = threads;
+                    result.frames = options.repeats;
+                    result.msPerFrame = median(frameMs);
+                    
+                    double seconds = 0.0;
+                    for (double ms : frameMs) seconds += ms * 1e-3;
+                    uint64_t samples = work.primarySamples + work.shadowSamples;
+                    // Cached shadow samples are trilinear lookups into the light cache
+                    int lookups = renderer->lookupsPerSample();
+                    int shadowLookups = options.shadowMode == ShadowMode::Cached ? 8 : lookups;
+                    double totalLookups = static_cast<double>(work.primarySamples) * lookups +
+                                          static_cast<double>(work.shadowSamples) * shadowLookups;
+                    result.raysPerSecond = (work.primaryRays + work.shadowRays) / seconds;
+                    result.samplesPerSecond = samples / seconds;
+                    result.lookupsPerRay = work.primaryRays ? totalLookups / work.primaryRays : 0.0;
+                    
+                    auto fraction = [](uint64_t part, uint64_t whole) {
+                        return whole ? static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+                    };
+                    result.emptySamples = fraction(work.emptySamples + work.emptyShadowSamples, samples);
+                    result.terminatedRays = fraction(work.terminatedRays, work.primaryRays);
+                    result.blockHits = fraction(work.blockHits, work.lookups);
+                    result.accessorHits = fraction(work.accessorHits, work.lookups - work.blockHits);
+                    
+                    result.stages = stages;
+                    double frameShadowMs = 1e3 * profiled.shadowSeconds / threads;
+                    result.stages.shadow = bakeMs + frameShadowMs;
+                    result.stages.march = std::max(profiledMs - frameShadowMs, 0.0);
+                    result.stages.output = timeMs([&] { image.save("render_bench_" + scene + ".ppm"); });
+                    if (costImage) {
+                        costHeatmap(cost).savePPM("render_bench_" + scene + "_cost.ppm");
+                    }
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+}
+
+void benchGround(const std::string& scene, int lightGrid, const BenchOptions& options,
+                 std::vector<BenchResult>& results) {
+    Lighting lighting;
+    addLightGrid(lighting, lightGrid, 5.0 / std::max(lightGrid - 1, 1));
+    lighting.setCullThreshold(1.0 / 512.0);
+    StageTimes setup;
+    setup.accel = timeMs([&] { lighting.buildLightGrid(); });
+    
+    for (auto [width, height] : options.sizes) {
+        CameraT<double> camera = groundCamera(width, height);
+        Image image(width, height);
+        
+        for (int threads : options.threads) {
+            omp_set_num_threads(threads);
+            size_t hits = renderGroundScene(camera, lighting, image);
+            
+            std::vector<double> frameMs;
+            for (int i = 0; i < options.repeats; ++i) {
+                frameMs.push_back(timeMs([&] { renderGroundScene(camera, lighting, image); }));
+            }
+            
+            BenchResult result;
+            result.scene = scene;
+            result.width = width;
+            result.height = height;
+            result.threads = threads;
+            result.frames = options.repeats;
+            result.msPerFrame = median(frameMs);
+            
+            // One primary ray per pixel and one shading sample per ground hit
+            double seconds = 1e-3 * result.msPerFrame;
+            result.raysPerSecond = static_cast<double>(width) * height / seconds;
+            result.samplesPerSecond = hits / seconds;
+            
+            result.stages = setup;
+            result.stages.march = result.msPerFrame;
+            result.stages.output = timeMs([&] { image.save("render_bench_" + scene + ".ppm"); });
+            results.push_back(result);
+        }
+    }
+}
+
+void printResults(const std::vector<BenchResult>& results) {
+    std::cout << std::left << std::setw(12) << "Scene" << std::setw(8) << "Storage" << std::right
+              << std::setw(10) << "Size" << std::setw(7) << "Step" << std::setw(8) << "Threads"
+              << std::setw(11) << "ms/frame" << std::setw(12) << "Mrays/s" << std::setw(14) << "Msamples/s"
+              << std::setw(13) << "Lookups/ray" << std::setw(8) << "Empty%" << std::setw(7) << "Term%"
+              << std::setw(8) << "Block%" << std::setw(7) << "Acc%"
+              << "   load / accel / march / shadow / output (ms)" << std::endl;
+    for (const BenchResult& r : results) {
+        std::ostringstream size;
+        size << r.width << "x" << r.height;
+        std::cout << std::left << std::setw(12) << r.scene << std::setw(8) << r.storage << std::right << std::fixed
+                  << std::setw(10) << size.str() << std::setw(7) << std::setprecision(3) << r.stepSize
+                  << std::setw(8) << r.threads
+                  << std::setw(11) << std::setprecision(1) << r.msPerFrame
+                  << std::setw(12) << std::setprecision(2) << r.raysPerSecond * 1e-6
+                  << std::setw(14) << r.samplesPerSecond * 1e-6
+                  << std::setw(13) << std::setprecision(1) << r.lookupsPerRay
+                  << std::setw(8) << 100.0 * r.emptySamples << std::setw(7) << 100.0 * r.terminatedRays
+                  << std::setw(8) << 100.0 * r.blockHits << std::setw(7) << 100.0 * r.accessorHits
+                  << "   " << r.stages.load << " / " << r.stages.accel << " / " << r.stages.march
+                  << " / " << r.stages.shadow << " / " << r.stages.output << std::endl;
+    }
+}
+
+bool writeJson(const std::string& filename, const std::vector<BenchResult>& results) {
+    std::ofstream file(filename);
+    if (!file) {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return false;
+    }
+    
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    file << std::setprecision(6);
+    file << "{\n  \"timestamp\": " << seconds << ",\n";
+    file << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    file << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        file << "    {\"scene\": \"" << r.scene << "\", \"storage\": \"" << r.storage << "\", \"width\": " << r.width << ", \"height\": " << r.height
+             << ", \"step_size\": " << r.stepSize << ", \"threads\": " << r.threads << ", \"frames\": " << r.frames
+             << ",\n     \"ms_per_frame\": " << r.msPerFrame << ", \"rays_per_s\": " << r.raysPerSecond
+             << ", \"samples_per_s\": " << r.samplesPerSecond << ", \"lookups_per_ray\": " << r.lookupsPerRay
+             << ",\n     \"empty_samples\": " << r.emptySamples << ", \"terminated_rays\": " << r.terminatedRays
+             << ", \"block_hits\": " << r.blockHits << ", \"accessor_hits\": " << r.accessorHits
+             << ",\n     \"stages_ms\": {\"load\": " << r.stages.load << ", \"accel\": " << r.stages.accel
+             << ", \"march\": " << r.stages.march << ", \"shadow\": " << r.stages.shadow
+             << ", \"output\": " << r.stages.output << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return static_cast<bool>(file);
+}
+
+// Parse all of `text` as a number; false when it is not one or is out of range
+template <typename T>
+bool parseNumber(const std::string& text, T& value) {
+    std::istringstream stream(text);
+    return stream >> value && (stream >> std::ws).eof();
+}
+
+// Parse the comma-separated items of `text` for `option`, reporting the first invalid one
+template <typename T>
+bool parseList(const std::string& option, const std::string& text, std::vector<T>& values,
+               bool (*parse)(const std::string&, T&)) {
+    values.clear();
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty()) continue;
+        T value;
+        if (!parse(item, value)) {
+            std::cerr << "Invalid value for " << option << ": " << item << std::endl;
+            return false;
+        }
+        values.push_back(value);
+    }
+    return true;
+}
+
+bool parseString(const std::string& text, std::string& value) {
+    value = text;
+    return true;
+}
+
+// WxH with positive dimensions
+bool parseSize(const std::string& text, std::pair<int, int>& size) {
+    size_t x = text.find('x');
+    return x != std::string::npos && parseNumber(text.substr(0, x), size.first) &&
+           parseNumber(text.substr(x + 1), size.second) && size.first > 0 && size.second > 0;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options] [vdb_file]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --scenes LIST    ground, ground-many, synthetic and vdb (default: all, vdb with a file)" << std::endl;
+    std::cout << "  --sizes LIST     Image sizes, e.g. 320x240,800x600 (default)" << std::endl;
+    std::cout << "  --steps LIST     Volume ray march steps (default: 0.1,0.05)" << std::endl;
+    std::cout << "  --threads LIST   Thread counts (default: 1 and all hardware threads)" << std::endl;
+    std::cout << "  --storage LIST   Volume density storage: vdb, bricks (half), u16 and u8 (default: vdb)" << std::endl;
+    std::cout << "  --repeats N      Timed frames per configuration (default: 3)" << std::endl;
+    std::cout << "  --grid NAME      Density grid of the VDB file (default: density)" << std::endl;
+    std::cout << "  --shadows MODE   exact, cached or none (default: exact)" << std::endl;
+    std::cout << "  --traversal MODE fixed or hdda (default: fixed)" << std::endl;
+    std::cout << "  --json FILE      Also write the results as JSON" << std::endl;
+    std::cout << "  --cost-maps      Save a samples-per-pixel heatmap of each volume scene" << std::endl;
+}
+
+bool parseArguments(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--scenes" && i + 1 < argc) {
+            if (!parseList(arg, argv[++i], options.scenes, parseString)) return false;
+        } else if (arg == "--sizes" && i + 1 < argc) {
+            if (!parseList(arg, argv[++i], options.sizes, parseSize)) return false;
+        } else if (arg == "--steps" && i + 1 < argc) {
+            if (!parseList(arg, argv[++i], options.steps, parseNumber<float>)) return false;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!parseList(arg, argv[++i], options.threads, parseNumber<int>)) return false;
+            if (std::any_of(options.threads.begin(), options.threads.end(), [](int n) { return n < 1; })) {
+                std::cerr << "Thread counts must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--storage" && i + 1 < argc) {
+            if (!parseList(arg, argv[++i], options.storage, parseString)) return false;
+            for (const std::string& storage : options.storage) {
+                if (storage != "vdb" && storage != "bricks" && storage != "u16" && storage != "u8") {
+                    std::cerr << "Unknown storage: " << storage << std::endl;
+                    return false;
+                }
+            }
+        } else if (arg == "--repeats" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], options.repeats)) {
+                std::cerr << "Invalid value for " << arg << ": " << argv[i] << std::endl;
+                return false;
+            }
+            options.repeats = std::max(options.repeats, 1);
+        } else if (arg == "--grid" && i + 1 < argc) {
+            options.gridName = argv[++i];
+        } else if (arg == "--shadows" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "exact") {
+                options.shadowMode = ShadowMode::Exact;
+            } else if (mode == "cached") {
+                options.shadowMode = ShadowMode::Cached;
+            } else if (mode == "none") {
+                options.shadowMode = ShadowMode::None;
+            } else {
+                std::cerr << "Unknown shadow mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--traversal" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "fixed") {
+                options.traversalMode = TraversalMode::FixedStep;
+            } else if (mode == "hdda") {
+                options.traversalMode = TraversalMode::Hierarchical;
+            } else {
+                std::cerr << "Unknown traversal mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.jsonFile = argv[++i];
+        } else if (arg == "--cost-maps") {
+            options.costMaps = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        } else if (options.vdbFile.empty()) {
+            options.vdbFile = arg;
+        } else {
+            return false;
+        }
+    }
+    
+    if (options.scenes.empty()) {
+        options.scenes = {"ground", "ground-many", "synthetic"};
+        if (!options.vdbFile.empty()) options.scenes.push_back("vdb");
+    }
+    if (options.threads.empty()) {
+        int hardware = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+        options.threads = hardware > 1 ? std::vector<int>{1, hardware} : std::vector<int>{1};
+    }
+    if (options.sizes.empty() || options.steps.empty() || options.storage.empty()) {
+        std::cerr << "Sizes, steps and storage must not be empty" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseArguments(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    openvdb::initialize();
+    
+    try {
+        std::vector<BenchResult> results;
+        for (const std::string& scene : options.scenes) {
+            if (scene == "ground") {
+                benchGround(scene, 5, options, results);
+            } else if (scene == "ground-many") {
+                benchGround(scene, 33, options, results);
+            } else if (scene == "synthetic") {
+                openvdb::FloatGrid::Ptr grid;
+                double loadMs = timeMs([&] { grid = makeSyntheticExplosion(48, 0.05); });
+                benchVolume(scene, grid, loadMs, options, results);
+            } else if (scene == "vdb") {
+                if (options.vdbFile.empty()) {
+                    std::cerr << "The vdb scene needs a VDB file" << std::endl;
+                    return 1;
+                }
+                openvdb::FloatGrid::Ptr grid;
+                double loadMs = timeMs([&] { grid = loadDensity(options.vdbFile, options.gridName); });
+                benchVolume(scene, grid, loadMs, options, results);
+            } else {
+                std::cerr << "Unknown scene: " << scene << std::endl;
+                return 1;
+            }
+        }
+        
+        printResults(results);
+        if (!options.jsonFile.empty() && writeJson(options.jsonFile, results)) {
+            std::cout << "Results written to " << options.jsonFile << std::endl;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    
+    return 0;
+}
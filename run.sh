@@ -12,11 +12,11 @@ if [[ "$OSTYPE" == "darwin"* ]]; then
     
     # Compile with macOS-specific OpenMP flags
     echo "Compiling with macOS OpenMP support..."
-    g++ -std=c++17 -I./eigen -Xclang -fopenmp -isystem/opt/homebrew/opt/libomp/include -L/opt/homebrew/opt/libomp/lib -lomp -o main main.cpp
+    g++ -std=c++17 -O3 -Xclang -fopenmp -isystem/opt/homebrew/opt/libomp/include -L/opt/homebrew/opt/libomp/lib -lomp -o main main.cpp
 else
     # For non-macOS systems, try standard OpenMP compilation
     echo "Attempting standard OpenMP compilation..."
-    g++ -std=c++17 -I./eigen -fopenmp -o main main.cpp
+    g++ -std=c++17 -O3 -march=native -fopenmp -o main main.cpp
 fi
 
 # Run the program if compilation was successful
@@ -1,25 +1,143 @@
-#include "Eigen/Dense"
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "Camera.h"
+#include "Image.h"
+#include "Lighting.h"
+#include "VecMath.h"
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <vector>
 
-bool intersectGround(const Eigen::Vector3d& rayOrigin, 
-                    const Eigen::Vector3d& rayDir,
-                    double& t) {
+// Function to check if a ray intersects with the ground plane
+inline bool intersectGround(const Vec3d& rayOrigin, 
+                            const Vec3d& rayDir,
+                            double& t) {
     // Ground plane is at y = 0
-    if (std::abs(rayDir.y()) < 1e-6) return false; // Ray parallel to plane
+    if (std::abs(rayDir.y) < 1e-6) return false; // Ray parallel to plane
     
-    t = -rayOrigin.y() / rayDir.y();
+    t = -rayOrigin.y / rayDir.y;
     return t > 0;
 }
 
 // Function to calculate checkerboard pattern color
-Eigen::Vector3d getGroundColor(const Eigen::Vector3d& point) {
+inline Vec3d getGroundColor(const Vec3d& point) {
     // Create checkerboard pattern
-    int x = static_cast<int>(std::floor(point.x() / 2.0));
-    int z = static_cast<int>(std::floor(point.z() / 2.0));
+    int x = static_cast<int>(std::floor(point.x / 2.0));
+    int z = static_cast<int>(std::floor(point.z / 2.0));
     
     if ((x + z) % 2 == 0) {
-        return Eigen::Vector3d(0.8, 0.8, 0.8); // Light gray
+        return Vec3d(0.8, 0.8, 0.8); // Light gray
     } else {
-        return Eigen::Vector3d(0.2, 0.2, 0.2); // Dark gray
+        return Vec3d(0.2, 0.2, 0.2); // Dark gray
+    }
+}
+
+// Camera of the ground scene for a width x height image
+inline CameraT<double> groundCamera(int width, int height) {
+    return CameraT<double>(
+        Vec3d(0, 10, 20),  // Position camera above and behind the ground
+        Vec3d(0, 0, 0),   // Look at the origin
+        Vec3d(0, 1, 0),   // Up vector
+        60.0,                       // Field of view
+        static_cast<double>(width) / height, // Aspect ratio
+        0.1,                        // Near plane
+        1000.0                      // Far plane
+    );
+}
+
+// Add a gridSize x gridSize grid of small point lights above the ground
+inline void addLightGrid(Lighting& lighting, int gridSize = 5, double spacing = 1.0) {
+    const double lightHeight = 5.0;
+    const double lightRadius = 0.001;  // Very small radius for point-like appearance
+    
+    for (int i = -gridSize/2; i <= gridSize/2; ++i) {
+        for (int j = -gridSize/2; j <= gridSize/2; ++j) {
+            // Create a light at each grid point
+            Light light(
+                Vec3d(i * spacing, lightHeight, j * spacing),  // Position
+                // make light color factor of i and j
+                Vec3d(i/10.0, j/10.0, 0),                               // White light
+                2.0,                                                    // Intensity
+                lightRadius                                            // Small radius
+            );
+            lighting.addLight(light);
+        }
     }
-}
\ No newline at end of file
+}
+
+// Render the lit ground into `image` and return the number of pixels that
+// hit the ground
+inline size_t renderGroundScene(const CameraT<double>& camera, const Lighting& lighting, Image& image) {
+    const int width = image.getWidth();
+    const int height = image.getHeight();
+    size_t hits = 0;
+    
+    // Render the scene in tiles scheduled dynamically across threads; an
+    // empty sky tile costs far less than one covered by ground
+    const int tileWidth = 64;
+    const int tileHeight = 16;
+    const int tilesX = (width + tileWidth - 1) / tileWidth;
+    const int tilesY = (height + tileHeight - 1) / tileHeight;
+    const Vec3d rayOrigin = camera.getPosition();
+    const Vec3d normal(0, 1, 0);  // Ground normal always points up
+    
+    #pragma omp parallel reduction(+:hits)
+    {
+        // Per-thread scanline buffers for ray directions and shaded pixels
+        std::vector<Vec3d> rayDirs(tileWidth);
+        std::vector<float> rowPixels(tileWidth * 3);
+        
+        #pragma omp for schedule(dynamic, 1)
+        for (int tile = 0; tile < tilesX * tilesY; ++tile) {
+            int x0 = (tile % tilesX) * tileWidth;
+            int y0 = (tile / tilesX) * tileHeight;
+            int x1 = std::min(x0 + tileWidth, width);
+            int y1 = std::min(y0 + tileHeight, height);
+            int count = x1 - x0;
+            
+            for (int y = y0; y < y1; ++y) {
+                // Convert pixel coordinates to normalized device coordinates
+                double v = 1.0 - static_cast<double>(y) / height;  // Invert v-coordinate
+                
+                // Generate the tile's share of this scanline's rays at once
+                camera.generateRow(x0, count, width, v, rayDirs.data());
+                
+                for (int i = 0; i < count; ++i) {
+                    const Vec3d& rayDir = rayDirs[i];
+                    Vec3d finalColor(0, 0, 0);  // Sky color
+                    
+                    // Check for intersection with ground
+                    double t;
+                    if (intersectGround(rayOrigin, rayDir, t)) {
+                        ++hits;
+                        
+                        // Calculate intersection point
+                        Vec3d hitPoint = rayOrigin + rayDir * t;
+                        
+                        // Get base color from checkerboard pattern
+                        Vec3d baseColor = getGroundColor(hitPoint);
+                        
+                        // Calculate view direction
+                        Vec3d viewDir = -rayDir;
+                        
+                        // Calculate final color using Phong lighting
+                        finalColor = lighting.calculatePhongLighting(
+                            hitPoint, normal, viewDir, baseColor);
+                    }
+                    
+                    rowPixels[i * 3] = static_cast<float>(finalColor.x);
+                    rowPixels[i * 3 + 1] = static_cast<float>(finalColor.y);
+                    rowPixels[i * 3 + 2] = static_cast<float>(finalColor.z);
+                }
+                
+                image.writeRow(y, x0, count, rowPixels.data());
+            }
+        }
+    }
+    
+    return hits;
+}
+
+#endif // SCENE_H
@@ -1,180 +1,843 @@
 #include <openvdb/openvdb.h>
+#include <openvdb/tools/GridTransformer.h>
+#include <openvdb/tools/Interpolation.h>
+#include <openvdb/tools/Morphology.h>
+#include <openvdb/tools/RayIntersector.h>
+#include <openvdb/tree/LeafManager.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/global_control.h>
+#include <tbb/parallel_for.h>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <cmath>
 #include <limits>
 #include <random>
 #include <fstream>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <stdexcept>
 
-// Vector3 class for ray tracing
-struct Vec3 {
-    float x, y, z;
+#include "GpuRenderer.h"
+#include "VolumeRenderer.h"
+
+// Time the same frame at increasing thread counts to check core scaling
+void runScalingBenchmark(const VolumeRenderer& renderer, const Camera& camera, int width, int height,
+                         uint32_t seed, int tileSize, bool packets) {
+    Image pixels(width, height);
+    const int threadCounts[] = {1, 2, 4, 8, 16};
+    double baseMs = 0.0;
     
-    Vec3(float x_ = 0, float y_ = 0, float z_ = 0) : x(x_), y(y_), z(z_) {}
+    std::cout << "Threads  Time (ms)  Speedup  Efficiency" << std::endl;
+    for (int threads : threadCounts) {
+        tbb::global_control parallelism(tbb::global_control::max_allowed_parallelism, threads);
+        auto start = std::chrono::steady_clock::now();
+        renderImage(renderer, camera, width, height, pixels, seed, tileSize, packets);
+        auto end = std::chrono::steady_clock::now();
+        
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (threads == 1) baseMs = ms;
+        double speedup = baseMs / ms;
+        std::cout << std::setw(7) << threads << "  " << std::setw(9) << std::fixed << std::setprecision(1) << ms
+                  << "  " << std::setw(7) << std::setprecision(2) << speedup
+                  << "  " << std::setw(9) << std::setprecision(0) << 100.0 * speedup / threads << "%" << std::endl;
+    }
+}
+
+// One frame's hot-path counters, as totals and rates
+void printStats(const RenderStats& stats) {
+    auto percent = [](uint64_t part, uint64_t whole) {
+        return whole ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+    };
+    auto perRay = [](uint64_t samples, uint64_t rays) {
+        return rays ? static_cast<double>(samples) / static_cast<double>(rays) : 0.0;
+    };
+    uint64_t blockMisses = stats.lookups - stats.blockHits;
     
-    Vec3 operator+(const Vec3& v) const { return Vec3(x + v.x, y + v.y, z + v.z); }
-    Vec3 operator-(const Vec3& v) const { return Vec3(x - v.x, y - v.y, z - v.z); }
-    Vec3 operator*(float f) const { return Vec3(x * f, y * f, z * f); }
-    Vec3 operator/(float f) const { return Vec3(x / f, y / f, z / f); }
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "  Primary: " << stats.primaryRays << " rays, " << stats.primarySamples << " samples ("
+              << perRay(stats.primarySamples, stats.primaryRays) << "/ray, "
+              << percent(stats.emptySamples, stats.primarySamples) << "% empty), "
+              << percent(stats.terminatedRays, stats.primaryRays) << "% terminated early" << std::endl;
+    std::cout << "  Shadow:  " << stats.shadowRays << " rays, " << stats.shadowSamples << " samples ("
+              << perRay(stats.shadowSamples, stats.shadowRays) << "/ray, "
+              << percent(stats.emptyShadowSamples, stats.shadowSamples) << "% empty), "
+              << percent(stats.terminatedShadowRays, stats.shadowRays) << "% terminated early" << std::endl;
+    std::cout << "  Lookups: " << stats.lookups << ", " << percent(stats.blockHits, stats.lookups)
+              << "% in the previous block, " << percent(stats.accessorHits, blockMisses)
+              << "% of block changes cached by the accessor" << std::endl;
+}
+
+// World-space region of `gridName` that can contribute to the image window
+// [u0, u1] x [v0, v1]: its stored bounding box clipped to the window's
+// frustum, then swept toward the light so offscreen shadow casters within
+// shadow range are kept. Only the grid's file metadata is read. False when
+// the file has no bounding box metadata or the grid is out of view.
+bool visibleBounds(openvdb::io::File& file, const std::string& gridName, const Camera& camera,
+                   const Vec3& lightDir, openvdb::BBoxd& bounds,
+                   float u0 = 0.0f, float v0 = 0.0f, float u1 = 1.0f, float v1 = 1.0f) {
+    openvdb::GridBase::Ptr meta = file.readGridMetadata(gridName);
+    if (!(*meta)[openvdb::GridBase::META_FILE_BBOX_MIN] || !(*meta)[openvdb::GridBase::META_FILE_BBOX_MAX]) {
+        return false;
+    }
+    
+    // Pad by a voxel for the trilinear stencil
+    openvdb::Vec3i indexMin = meta->metaValue<openvdb::Vec3i>(openvdb::GridBase::META_FILE_BBOX_MIN);
+    openvdb::Vec3i indexMax = meta->metaValue<openvdb::Vec3i>(openvdb::GridBase::META_FILE_BBOX_MAX);
+    openvdb::CoordBBox indexBox(openvdb::Coord(indexMin[0], indexMin[1], indexMin[2]),
+                                openvdb::Coord(indexMax[0], indexMax[1], indexMax[2]));
+    indexBox.expand(1);
+    openvdb::BBoxd world = meta->transform().indexToWorld(indexBox);
+    Vec3 worldMin(world.min().x(), world.min().y(), world.min().z());
+    Vec3 worldMax(world.max().x(), world.max().y(), world.max().z());
     
-    float length() const { return std::sqrt(x*x + y*y + z*z); }
-    Vec3 normalize() const { float l = length(); return Vec3(x/l, y/l, z/l); }
-    float dot(const Vec3& v) const { return x*v.x + y*v.y + z*v.z; }
-    Vec3 cross(const Vec3& v) const {
-        return Vec3(y*v.z - z*v.y, z*v.x - x*v.z, x*v.y - y*v.x);
+    Vec3 clipMin, clipMax;
+    if (!camera.clipBox(worldMin, worldMax, clipMin, clipMax, u0, v0, u1, v1)) {
+        return false;
     }
-    Vec3 componentMul(const Vec3& v) const {
-        return Vec3(x*v.x, y*v.y, z*v.z);
+    
+    // Shadow rays run from the visible part to the far side of the volume
+    Vec3 sweep = lightDir.normalized() * (worldMax - worldMin).length();
+    clipMin = Vec3::max(Vec3::min(clipMin, clipMin + sweep), worldMin);
+    clipMax = Vec3::min(Vec3::max(clipMax, clipMax + sweep), worldMax);
+    bounds = openvdb::BBoxd(openvdb::Vec3d(clipMin.x, clipMin.y, clipMin.z),
+                            openvdb::Vec3d(clipMax.x, clipMax.y, clipMax.z));
+    return true;
+}
+
+// Command line options
+struct RenderOptions {
+    std::string vdbFile;
+    ShadowMode shadowMode = ShadowMode::Exact;
+    int shadowCacheDownsample = 1;
+    bool shadowReuse = false;
+    float shadowReuseTolerance = 1e-3f;
+    TraversalMode traversalMode = TraversalMode::FixedStep;
+    bool scalingBenchmark = false;
+    int tileSize = 16;
+    bool packets = false;
+    SamplerMode samplerMode = SamplerMode::Nearest;
+    float stepSize = 0.1f;
+    StepMode stepMode = StepMode::Fixed;
+    Integrator integrator = Integrator::RayMarch;
+    float phaseG = 0.0f;
+    float primaryThreshold = 0.01f;
+    float shadowThreshold = 0.01f;
+    bool russianRoulette = false;
+    int samplesPerPixel = 1;
+    bool progressive = false;
+    bool emission = true;
+    
+    // Coarse-to-fine preview: refinement contrast threshold and save interval
+    bool preview = false;
+    float previewThreshold = 0.02f;
+    float previewInterval = 1.0f;
+    float temperatureScale = 1000.0f;
+    float emissionScale = 1.0f;
+    bool fullRead = false;
+    bool exr = false;
+    bool bricks = false;
+    int quantizeBits = 0;  // 16 or 8 to quantize the density at load, 0 to keep floats
+    
+    // Per-frame hot-path counters and per-pixel sample cost heatmap
+    bool stats = false;
+    bool costMap = false;
+    
+    // Coarser density levels for distant samples, and the footprint multiplier
+    int lodLevels = 0;
+    float lodBias = 1.0f;
+    
+    // Frame range of a sequence; vdbFile is then a printf pattern
+    bool sequence = false;
+    int firstFrame = 0;
+    int lastFrame = 0;
+    
+    // Full frame size, and the crop windows of it to render; none renders
+    // the whole frame. A crop grid of columns x rows adds every cell, or
+    // only cell cropCell in row-major order when it is set.
+    int width = 800;
+    int height = 600;
+    std::vector<Tile> crops;
+    int cropColumns = 0;
+    int cropRows = 0;
+    int cropCell = -1;
+};
+
+// Smallest window covering every crop, or the full frame without crops
+Tile cropBounds(const RenderOptions& options) {
+    if (options.crops.empty()) {
+        return {0, 0, options.width, options.height};
     }
-    static Vec3 max(const Vec3& a, const Vec3& b) {
-        return Vec3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+    Tile bounds = options.crops.front();
+    for (const Tile& crop : options.crops) {
+        bounds = {std::min(bounds.x0, crop.x0), std::min(bounds.y0, crop.y0),
+                  std::max(bounds.x1, crop.x1), std::max(bounds.y1, crop.y1)};
     }
-    static Vec3 min(const Vec3& a, const Vec3& b) {
-        return Vec3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+    return bounds;
+}
+
+// Parse all of `text` as a number for `option`, reporting it when it is
+// not one or is out of range
+template<typename T>
+bool parseNumber(const std::string& option, const std::string& text, T& value) {
+    std::istringstream stream(text);
+    if (stream >> value && (stream >> std::ws).eof()) return true;
+    std::cerr << "Invalid value for " << option << ": " << text << std::endl;
+    return false;
+}
+
+// Whether `pattern` holds exactly one integer conversion, %d or %0Nd, and no
+// other '%', so framePath() can hand it to snprintf
+bool isFramePattern(const std::string& pattern) {
+    size_t percent = pattern.find('%');
+    if (percent == std::string::npos || pattern.find('%', percent + 1) != std::string::npos) {
+        return false;
     }
-};
+    size_t i = percent + 1;
+    while (i < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[i]))) ++i;
+    return i < pattern.size() && pattern[i] == 'd';
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options] <vdb_file>" << std::endl;
+    std::cout << "       " << program << " [options] --frames A:B <vdb_pattern>   e.g. explosion.%04d.vdb" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --frames A:B             Render frames A to B of a sequence into volume_render.NNNN.ppm" << std::endl;
+    std::cout << "  --resolution WxH         Full frame size in pixels (default: 800x600)" << std::endl;
+    std::cout << "  --crop X0,Y0,X1,Y1       Render only pixels [X0, X1) x [Y0, Y1) into volume_render.crop_X0_Y0.ppm;" << std::endl;
+    std::cout << "                           repeat for a tile list, then assemble the crops with merge_tiles" << std::endl;
+    std::cout << "  --crop-grid CxR[:K]      Crop the frame into C x R tiles and render all, or only tile K (row-major)" << std::endl;
+    std::cout << "  --shadows MODE           exact shadow rays, cached light transmittance, or none (default: exact)" << std::endl;
+    std::cout << "  --shadow-cache-res N     Light cache voxel size as a multiple of the density voxel size (default: 1)" << std::endl;
+    std::cout << "  --shadow-reuse F         Update the light cache between frames only where density drifted by more than F" << std::endl;
+    std::cout << "  --traversal fixed|hdda   Fixed-step bounding box march or hierarchical empty-space skipping (default: fixed)" << std::endl;
+    std::cout << "  --tile-size N            Edge length in pixels of the scheduled screen tiles (default: 16)" << std::endl;
+    std::cout << "  --sampler nearest|trilinear|stochastic  Density reconstruction filter (default: nearest)" << std::endl;
+    std::cout << "  --step-size F            Ray march step in world units (default: 0.1)" << std::endl;
+    std::cout << "  --adaptive-step          Stretch the step through thin leaves using per-leaf density bounds" << std::endl;
+    std::cout << "  --integrator march|delta Ray marching or delta/ratio tracking (default: march)" << std::endl;
+    std::cout << "  --phase-g G              Henyey-Greenstein scattering with asymmetry G in (-1, 1); 0 is isotropic (default: 0)" << std::endl;
+    std::cout << "  --termination F          Transmittance below which primary rays stop (default: 0.01)" << std::endl;
+    std::cout << "  --shadow-termination F   Transmittance below which shadow rays stop (default: 0.01)" << std::endl;
+    std::cout << "  --roulette               Russian roulette below the termination thresholds instead of stopping" << std::endl;
+    std::cout << "  --spp N                  Samples per pixel, one frame pass each (default: 1)" << std::endl;
+    std::cout << "  --progressive            Save the running average after every pass" << std::endl;
+    std::cout << "  --preview                Save a coarse image first, then refine where neighbouring pixels differ" << std::endl;
+    std::cout << "  --preview-threshold F    Corner contrast above which preview blocks are refined; 0 refines all (default: 0.02)" << std::endl;
+    std::cout << "  --preview-interval S     Seconds between preview saves while refining (default: 1)" << std::endl;
+    std::cout << "  --temp-scale F           Kelvin per temperature grid unit for blackbody emission (default: 1000)" << std::endl;
+    std::cout << "  --emission-scale F       Emitted radiance per unit flame at full glow (default: 1)" << std::endl;
+    std::cout << "  --no-emission            Ignore the temperature and flame grids" << std::endl;
+    std::cout << "  --lod N                  Sample density from up to N coarser levels (2x each, max 3) by pixel footprint" << std::endl;
+    std::cout << "  --lod-bias F             Scale the footprint used to pick a level (default: 1)" << std::endl;
+    std::cout << "  --exr                    Save unclamped float EXR instead of PPM" << std::endl;
+    std::cout << "  --full-read              Read whole grids instead of only the region visible to the camera" << std::endl;
+    std::cout << "  --bricks                 Sample density from a dense half-float brick copy instead of the VDB tree" << std::endl;
+    std::cout << "  --quantize 16|8          Keep only 16- or 8-bit density bricks with per-leaf scale and offset" << std::endl;
+    std::cout << "  --packets                March primary rays in packets of 8 coherent rays" << std::endl;
+    std::cout << "  --stats                  Print sample, termination and cache counters for every frame" << std::endl;
+    std::cout << "  --cost-map               Also save a heatmap of samples per pixel to volume_render_cost.ppm" << std::endl;
+    std::cout << "  --bench-scaling          Time the frame at 1/2/4/8/16 threads instead of saving an image" << std::endl;
+}
 
-// Ray class
-struct Ray {
-    Vec3 origin;
-    Vec3 direction;
+bool parseArguments(int argc, char** argv, RenderOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--shadows" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "exact") {
+                options.shadowMode = ShadowMode::Exact;
+            } else if (mode == "cached") {
+                options.shadowMode = ShadowMode::Cached;
+            } else if (mode == "none") {
+                options.shadowMode = ShadowMode::None;
+            } else {
+                std::cerr << "Unknown shadow mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--shadow-cache-res" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.shadowCacheDownsample)) return false;
+            if (options.shadowCacheDownsample < 1) {
+                std::cerr << "Light cache resolution must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--shadow-reuse" && i + 1 < argc) {
+            options.shadowReuse = true;
+            if (!parseNumber(arg, argv[++i], options.shadowReuseTolerance)) return false;
+            if (options.shadowReuseTolerance < 0.0f) {
+                std::cerr << "Light cache reuse tolerance must not be negative" << std::endl;
+                return false;
+            }
+        } else if (arg == "--traversal" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "fixed") {
+                options.traversalMode = TraversalMode::FixedStep;
+            } else if (mode == "hdda") {
+                options.traversalMode = TraversalMode::Hierarchical;
+            } else {
+                std::cerr << "Unknown traversal mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--tile-size" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.tileSize)) return false;
+            if (options.tileSize < 1) {
+                std::cerr << "Tile size must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--sampler" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "nearest") {
+                options.samplerMode = SamplerMode::Nearest;
+            } else if (mode == "trilinear") {
+                options.samplerMode = SamplerMode::Trilinear;
+            } else if (mode == "stochastic") {
+                options.samplerMode = SamplerMode::StochasticTrilinear;
+            } else {
+                std::cerr << "Unknown sampler: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--step-size" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.stepSize)) return false;
+            if (options.stepSize <= 0.0f) {
+                std::cerr << "Step size must be positive" << std::endl;
+                return false;
+            }
+        } else if (arg == "--adaptive-step") {
+            options.stepMode = StepMode::Adaptive;
+        } else if (arg == "--integrator" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "march") {
+                options.integrator = Integrator::RayMarch;
+            } else if (mode == "delta") {
+                options.integrator = Integrator::DeltaTracking;
+            } else {
+                std::cerr << "Unknown integrator: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg == "--phase-g" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.phaseG)) return false;
+            if (!(std::abs(options.phaseG) < 1.0f)) {
+                std::cerr << "Phase asymmetry must be between -1 and 1" << std::endl;
+                return false;
+            }
+        } else if ((arg == "--termination" || arg == "--shadow-termination") && i + 1 < argc) {
+            float& threshold = arg == "--termination" ? options.primaryThreshold : options.shadowThreshold;
+            if (!parseNumber(arg, argv[++i], threshold)) return false;
+            if (!(threshold >= 0.0f && threshold < 1.0f)) {
+                std::cerr << "Termination thresholds must be in [0, 1)" << std::endl;
+                return false;
+            }
+        } else if (arg == "--roulette") {
+            options.russianRoulette = true;
+        } else if (arg == "--spp" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.samplesPerPixel)) return false;
+            if (options.samplesPerPixel < 1) {
+                std::cerr << "Samples per pixel must be at least 1" << std::endl;
+                return false;
+            }
+        } else if (arg == "--progressive") {
+            options.progressive = true;
+        } else if (arg == "--preview") {
+            options.preview = true;
+        } else if (arg == "--preview-threshold" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.previewThreshold)) return false;
+        } else if (arg == "--preview-interval" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.previewInterval)) return false;
+        } else if (arg == "--temp-scale" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.temperatureScale)) return false;
+        } else if (arg == "--emission-scale" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.emissionScale)) return false;
+        } else if (arg == "--no-emission") {
+            options.emission = false;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            std::string range = argv[++i];
+            size_t colon = range.find(':');
+            if (!parseNumber(arg, range.substr(0, colon), options.firstFrame)) return false;
+            options.lastFrame = options.firstFrame;
+            if (colon != std::string::npos && !parseNumber(arg, range.substr(colon + 1), options.lastFrame)) {
+                return false;
+            }
+            options.sequence = true;
+            if (options.lastFrame < options.firstFrame) {
+                std::cerr << "Frame range must not be empty" << std::endl;
+                return false;
+            }
+        } else if (arg == "--resolution" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+                options.width < 1 || options.height < 1) {
+                std::cerr << "Resolution must be given as WxH, e.g. 1920x1080" << std::endl;
+                return false;
+            }
+        } else if (arg == "--crop" && i + 1 < argc) {
+            Tile crop;
+            if (std::sscanf(argv[++i], "%d,%d,%d,%d", &crop.x0, &crop.y0, &crop.x1, &crop.y1) != 4) {
+                std::cerr << "A crop window is given as X0,Y0,X1,Y1" << std::endl;
+                return false;
+            }
+            options.crops.push_back(crop);
+        } else if (arg == "--crop-grid" && i + 1 < argc) {
+            int fields = std::sscanf(argv[++i], "%dx%d:%d", &options.cropColumns, &options.cropRows, &options.cropCell);
+            if (fields < 2 || options.cropColumns < 1 || options.cropRows < 1 ||
+                (fields == 3 && (options.cropCell < 0 || options.cropCell >= options.cropColumns * options.cropRows))) {
+                std::cerr << "A crop grid is given as CxR or CxR:K with 0 <= K < C * R" << std::endl;
+                return false;
+            }
+        } else if (arg == "--lod" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.lodLevels)) return false;
+            if (options.lodLevels < 0 || options.lodLevels > 3) {
+                std::cerr << "Level of detail must be between 0 and 3" << std::endl;
+                return false;
+            }
+        } else if (arg == "--lod-bias" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.lodBias)) return false;
+        } else if (arg == "--exr") {
+            if (!ImageIO::hasEXR()) {
+                std::cerr << "Built without OpenEXR; EXR output is unavailable" << std::endl;
+                return false;
+            }
+            options.exr = true;
+        } else if (arg == "--full-read") {
+            options.fullRead = true;
+        } else if (arg == "--bricks") {
+            options.bricks = true;
+        } else if (arg == "--quantize" && i + 1 < argc) {
+            if (!parseNumber(arg, argv[++i], options.quantizeBits)) return false;
+            if (options.quantizeBits != 16 && options.quantizeBits != 8) {
+                std::cerr << "Quantized density has 16 or 8 bits" << std::endl;
+                return false;
+            }
+        } else if (arg == "--packets") {
+            options.packets = true;
+        } else if (arg == "--stats" || arg == "--cost-map") {
+            if (!RenderStatsEnabled) {
+                std::cerr << "Built with VOLUME_RENDER_STATS=0; " << arg << " is unavailable" << std::endl;
+                return false;
+            }
+            if (arg == "--stats") {
+                options.stats = true;
+            } else {
+                options.costMap = true;
+            }
+        } else if (arg == "--bench-scaling") {
+            options.scalingBenchmark = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        } else if (options.vdbFile.empty()) {
+            options.vdbFile = arg;
+        } else {
+            return false;
+        }
+    }
+    if (options.sequence && !isFramePattern(options.vdbFile)) {
+        std::cerr << "A frame range needs a file pattern with one %d or %0Nd, such as explosion.%04d.vdb" << std::endl;
+        return false;
+    }
+    if (options.preview && (options.sequence || options.samplesPerPixel > 1 || options.scalingBenchmark)) {
+        std::cerr << "--preview renders one sample per pixel of a single frame" << std::endl;
+        return false;
+    }
+    if ((options.stats || options.costMap) && (options.preview || options.scalingBenchmark)) {
+        std::cerr << "--stats and --cost-map instrument the final frame render" << std::endl;
+        return false;
+    }
+    
+    // Grid cells split the frame evenly, the last ones taking the remainder
+    for (int cell = 0; cell < options.cropColumns * options.cropRows; ++cell) {
+        if (options.cropCell >= 0 && cell != options.cropCell) continue;
+        int column = cell % options.cropColumns, row = cell / options.cropColumns;
+        options.crops.push_back({column * options.width / options.cropColumns, row * options.height / options.cropRows,
+                                 (column + 1) * options.width / options.cropColumns,
+                                 (row + 1) * options.height / options.cropRows});
+    }
+    for (const Tile& crop : options.crops) {
+        if (crop.x0 < 0 || crop.y0 < 0 || crop.x1 > options.width || crop.y1 > options.height ||
+            crop.x0 >= crop.x1 || crop.y0 >= crop.y1) {
+            std::cerr << "Crop window " << crop.x0 << "," << crop.y0 << "," << crop.x1 << "," << crop.y1
+                      << " is empty or outside the " << options.width << "x" << options.height << " frame" << std::endl;
+            return false;
+        }
+    }
+    if (options.shadowReuse && (options.shadowMode != ShadowMode::Cached || !options.sequence)) {
+        std::cerr << "--shadow-reuse carries the cached light (--shadows cached) across the frames of a sequence" << std::endl;
+        return false;
+    }
+    if (!options.crops.empty() && (options.preview || options.scalingBenchmark)) {
+        std::cerr << "--crop and --crop-grid render final frames" << std::endl;
+        return false;
+    }
+    return !options.vdbFile.empty();
+}
+
+// Expand a printf pattern such as "explosion.%04d.vdb", checked by
+// isFramePattern(), for one frame
+std::string framePath(const std::string& pattern, int frame) {
+    std::vector<char> path(std::snprintf(nullptr, 0, pattern.c_str(), frame) + 1);
+    std::snprintf(path.data(), path.size(), pattern.c_str(), frame);
+    return path.data();
+}
+
+// Box-filter a grid to half the resolution: the coarse transform maps voxel
+// j onto the centre of fine voxels 2j and 2j + 1, where trilinear
+// interpolation averages the 2x2x2 fine voxels it covers
+openvdb::FloatGrid::Ptr downsample(const openvdb::FloatGrid& fine) {
+    openvdb::math::Transform::Ptr xform = fine.transform().copy();
+    xform->preTranslate(openvdb::Vec3d(0.5));
+    xform->preScale(2.0);
     
-    Ray(const Vec3& o, const Vec3& d) : origin(o), direction(d.normalize()) {}
+    openvdb::FloatGrid::Ptr coarse = openvdb::FloatGrid::create(fine.background());
+    coarse->setTransform(xform);
+    coarse->setName(fine.getName());
+    openvdb::tools::resampleToMatch<openvdb::tools::BoxSampler>(fine, *coarse);
+    return coarse;
+}
+
+// Density mip levels 1 to `count` for the file at `path`, cached beside it
+// as <path>.mip<k>.vdb. Missing or stale caches are rebuilt from the full
+// source grid; cached levels are read clipped to `readBounds` when given.
+std::vector<openvdb::FloatGrid::Ptr> loadMipLevels(const std::string& path, int count,
+                                                   const openvdb::BBoxd* readBounds, bool pageIn) {
+    std::vector<openvdb::FloatGrid::Ptr> levels;
+    auto sourceTime = std::filesystem::last_write_time(path);
+    for (int k = 1; k <= count; ++k) {
+        std::string levelPath = path + ".mip" + std::to_string(k) + ".vdb";
+        if (!std::filesystem::exists(levelPath) || std::filesystem::last_write_time(levelPath) < sourceTime) {
+            break;
+        }
+        openvdb::io::File file(levelPath);
+        file.setCopyMaxBytes(0);
+        file.open(true);
+        openvdb::GridBase::Ptr baseGrid = readBounds ? file.readGrid("density", *readBounds) : file.readGrid("density");
+        levels.push_back(openvdb::gridPtrCast<openvdb::FloatGrid>(baseGrid));
+        if (pageIn) {
+            levels.back()->tree().readNonresidentBuffers();
+        }
+        file.close();
+    }
+    if (static_cast<int>(levels.size()) == count) {
+        return levels;
+    }
+    
+    // Rebuild every level from the whole source so the caches suit any camera
+    levels.clear();
+    openvdb::io::File source(path);
+    source.open(true);
+    openvdb::FloatGrid::Ptr level = openvdb::gridPtrCast<openvdb::FloatGrid>(source.readGrid("density"));
+    source.close();
+    for (int k = 1; k <= count; ++k) {
+        level = downsample(*level);
+        levels.push_back(level);
+        
+        std::string levelPath = path + ".mip" + std::to_string(k) + ".vdb";
+        openvdb::io::File(levelPath).write(openvdb::GridCPtrVec{level});
+        std::cout << "Cached density level " << k << " in " << levelPath << std::endl;
+    }
+    return levels;
+}
+
+// Grids of one frame. A quantized density is held in densityBricks, and
+// its grid only keeps the topology with per-leaf maxima.
+struct FrameGrids {
+    openvdb::FloatGrid::Ptr density, temperature, flame;
+    std::vector<openvdb::FloatGrid::Ptr> densityLevels;
+    std::shared_ptr<const BrickPool> densityBricks;
+    openvdb::Index64 floatDensityBytes = 0;  // Density memory before quantizing
 };
 
-// Camera class
-class Camera {
-public:
-    Camera(const Vec3& pos, const Vec3& lookAt, const Vec3& upVec, float fov, float aspect) {
-        position = pos;
-        forward = (lookAt - pos).normalize();
-        right = forward.cross(upVec).normalize();
-        Vec3 up = forward.cross(right).normalize();
+// Read the grids of one file for `camera`. The file is opened delay-loaded:
+// grids are read topology first and leaf buffers are paged in from the
+// memory-mapped file on first touch, with no private copy of the file made
+// before mapping it. With `pageIn`, every buffer is paged in up front, so a
+// prefetch thread takes the I/O instead of the render.
+FrameGrids loadFrame(const std::string& path, const RenderOptions& options, const Camera& camera,
+                     const Vec3& lightDir, bool pageIn) {
+    openvdb::io::File file(path);
+    file.setCopyMaxBytes(0);
+    file.open(true);
+    
+    // Read only the voxels that can reach the crop windows
+    Tile window = cropBounds(options);
+    float u0 = static_cast<float>(window.x0) / options.width, u1 = static_cast<float>(window.x1) / options.width;
+    float v0 = 1.0f - static_cast<float>(window.y1) / options.height;  // Rows run top to bottom
+    float v1 = 1.0f - static_cast<float>(window.y0) / options.height;
+    openvdb::BBoxd readBounds;
+    bool clipRead = !options.fullRead && visibleBounds(file, "density", camera, lightDir, readBounds, u0, v0, u1, v1);
+    auto readFloatGrid = [&](const std::string& name) {
+        openvdb::GridBase::Ptr baseGrid = clipRead ? file.readGrid(name, readBounds) : file.readGrid(name);
+        openvdb::FloatGrid::Ptr grid = openvdb::gridPtrCast<openvdb::FloatGrid>(baseGrid);
+        if (!grid) {
+            throw std::runtime_error("Grid \"" + name + "\" in " + path + " is not a float grid");
+        }
+        if (pageIn) {
+            grid->tree().readNonresidentBuffers();
+        }
+        return grid;
+    };
+    
+    FrameGrids frame;
+    frame.density = readFloatGrid("density");
+    
+    // Temperature and flame grids, when present, drive blackbody emission
+    if (options.emission && file.hasGrid("temperature")) {
+        frame.temperature = readFloatGrid("temperature");
+        if (file.hasGrid("flame")) {
+            frame.flame = readFloatGrid("flame");
+        }
         
-        float tanFov = std::tan(fov * 0.5f * M_PI / 180.0f);
-        this->right = right * (tanFov * aspect);
-        this->up = up * tanFov;
+        // The renderer unions the topologies in place anyway; doing it here
+        // leaves the frame's grids final before anything else reads them
+        VolumeRenderer::matchEmissionTopology(*frame.density, frame.temperature, frame.flame);
     }
     
-    Ray getRay(float u, float v) const {
-        Vec3 direction = forward + right * (u * 2.0f - 1.0f) + up * (v * 2.0f - 1.0f);
-        return Ray(position, direction.normalize());
+    // Emission channels have no pyramid, so it is only worth loading without them
+    if (options.lodLevels > 0 && !frame.temperature) {
+        frame.densityLevels = loadMipLevels(path, options.lodLevels, clipRead ? &readBounds : nullptr, pageIn);
     }
     
-private:
-    Vec3 position;
-    Vec3 forward, right, up;
-};
+    // Bake the quantized bricks, which pages the density in, then drop its
+    // voxels. This comes after the emission topology union, which would
+    // otherwise refill the released leaves and leave the pool short of the
+    // unioned blocks.
+    if (options.quantizeBits > 0) {
+        frame.floatDensityBytes = frame.density->memUsage();
+        BrickEncoding encoding = options.quantizeBits == 16 ? BrickEncoding::UInt16 : BrickEncoding::UInt8;
+        frame.densityBricks = std::make_shared<const BrickPool>(*frame.density, encoding);
+        BrickPool::releaseLeaves(*frame.density);
+    }
+    
+    // Delay-loaded grids keep the mapping alive after the file is closed
+    file.close();
+    return frame;
+}
 
-// Volume renderer class
-class VolumeRenderer {
+// Progressive preview. The coarse pass traces one pixel per PreviewStride^2
+// block with a longer step and a coarse light cache, so the first image
+// lands quickly. Refinement then traces at full quality: the stride-8
+// lattice again, then each halving of the lattice spacing, tracing new
+// lattice pixels only inside blocks whose four corners differ by more
+// than the threshold and interpolating them elsewhere. Pixels between
+// lattice points are filled bilinearly after every level.
+class PreviewRefiner {
 public:
-    VolumeRenderer(openvdb::FloatGrid::Ptr grid, const Vec3& lightDir, float stepSize = 0.1f)
-        : grid(grid), lightDir(lightDir.normalize()), stepSize(stepSize), accessor(grid->getConstAccessor())
-    {
-        bounds = grid->evalActiveVoxelBoundingBox();
-        t0 = Vec3(bounds.min().x(), bounds.min().y(), bounds.min().z());
-        t1 = Vec3(bounds.max().x(), bounds.max().y(), bounds.max().z());
+    static constexpr int PreviewStride = 8;
+    static constexpr float PreviewStepScale = 4.0f;
+    static constexpr int PreviewShadowDownsample = 4;
+    
+    PreviewRefiner(VolumeRenderer& renderer, const Camera& camera, Image& image,
+                   ContextPool& contexts, const RenderOptions& options, const std::string& output)
+        : renderer(renderer), camera(camera), image(image), contexts(contexts),
+          options(options), output(output),
+          width(image.getWidth()), height(image.getHeight()) {}
+    
+    // Switch the renderer to the cheap settings used by the coarse pass
+    void usePreviewQuality() {
+        renderer.setStepSize(options.stepSize * PreviewStepScale);
+        renderer.setShadowMode(ShadowMode::Cached,
+                               std::max(options.shadowCacheDownsample, PreviewShadowDownsample));
+        rebindContexts();
     }
     
-    Vec3 trace(const Ray& ray, std::mt19937& rng) const {
-        // Find intersection with bounding box
-        float tMin, tMax;
-        if (!intersectBox(ray, tMin, tMax)) {
-            return Vec3(0.0f); // Miss
-        }
+    void run() {
+        auto start = Clock::now();
+        lastSave = start;
         
-        // Start from first intersection
-        float t = tMin;
-        Vec3 color(0.0f);
-        float transmittance = 1.0f;
+        // Coarse pass at preview quality
+        std::vector<int> pixels = lattice(PreviewStride);
+        traceBatch(pixels, 0, pixels.size());
+        fill(PreviewStride);
+        save("Coarse preview", start);
         
-        // Ray march through volume
-        while (t < tMax && transmittance > 0.01f) {
-            Vec3 pos = ray.origin + ray.direction * t;
-            
-            // Get density at current position
-            float density = sampleDensity(pos);
-            
-            if (density > 0.0f) {
-                // Calculate light contribution
-                float lightDensity = traceShadowRay(pos);
-                
-                // Beer's law for extinction
-                float extinction = density * stepSize;
-                transmittance *= std::exp(-extinction);
-                
-                // Add scattered light contribution
-                float phase = 1.0f / (4.0f * M_PI); // Isotropic phase function
-                Vec3 scatteredLight = Vec3(1.0f) * phase * lightDensity;
-                color = color + scatteredLight * transmittance * extinction;
-            }
-            
-            t += stepSize;
-        }
+        // Final quality from the coarse lattice down to every pixel
+        renderer.setStepSize(options.stepSize);
+        renderer.setShadowMode(options.shadowMode, options.shadowCacheDownsample);
+        rebindContexts();
+        trace(pixels);
+        fill(PreviewStride);
         
-        return color;
+        for (int stride = PreviewStride; stride > 1; stride /= 2) {
+            trace(refine(stride));
+            fill(stride / 2);
+        }
+        save("Refined preview", start);
     }
     
 private:
-    openvdb::FloatGrid::Ptr grid;
-    openvdb::FloatGrid::ConstAccessor accessor;
-    openvdb::CoordBBox bounds;
-    Vec3 t0, t1;
-    Vec3 lightDir;
-    float stepSize;
+    using Clock = std::chrono::steady_clock;
+    
+    VolumeRenderer& renderer;
+    const Camera& camera;
+    Image& image;
+    ContextPool& contexts;
+    const RenderOptions& options;
+    std::string output;
+    int width, height;
+    Clock::time_point lastSave;
     
-    float sampleDensity(const Vec3& worldPos) const {
-        openvdb::Vec3d pos(worldPos.x, worldPos.y, worldPos.z);
-        return accessor.getValue(grid->transform().worldToIndexCellCentered(pos));
+    void rebindContexts() {
+        for (RenderContext& ctx : contexts) {
+            renderer.rebindContext(ctx);
+        }
     }
     
-    bool intersectBox(const Ray& ray, float& tMin, float& tMax) const {
-        Vec3 invDir(1.0f/ray.direction.x, 1.0f/ray.direction.y, 1.0f/ray.direction.z);
-        Vec3 tMin3 = (t0 - ray.origin).componentMul(invDir);
-        Vec3 tMax3 = (t1 - ray.origin).componentMul(invDir);
-        
-        Vec3 t1 = Vec3::max(tMin3, tMax3);
-        Vec3 t2 = Vec3::min(tMin3, tMax3);
-        
-        tMin = std::max(std::max(t2.x, t2.y), t2.z);
-        tMax = std::min(std::min(t1.x, t1.y), t1.z);
-        
-        return tMax >= tMin && tMax > 0;
+    // Pixel indices of the lattice with spacing `stride`
+    std::vector<int> lattice(int stride) const {
+        std::vector<int> pixels;
+        for (int y = 0; y < height; y += stride) {
+            for (int x = 0; x < width; x += stride) {
+                pixels.push_back(y * width + x);
+            }
+        }
+        return pixels;
     }
     
-    float traceShadowRay(const Vec3& pos) const {
-        float transmittance = 1.0f;
-        float t = 0.0f;
-        
-        while (t < 20.0f && transmittance > 0.01f) {
-            Vec3 samplePos = pos + lightDir * t;
-            float density = sampleDensity(samplePos);
-            transmittance *= std::exp(-density * stepSize);
-            t += stepSize;
+    // Lattice points bracketing `x` at spacing `stride`, clamped to the last
+    // lattice point so edge pixels hold its value
+    static void bracket(int x, int stride, int size, int& x0, int& x1, float& f) {
+        int last = (size - 1) / stride * stride;
+        x0 = std::min(x / stride * stride, last);
+        x1 = std::min(x0 + stride, last);
+        f = x1 > x0 ? static_cast<float>(x - x0) / (x1 - x0) : 0.0f;
+    }
+    
+    void interpolate(int x, int y, int stride) {
+        int x0, x1, y0, y1;
+        float fx, fy;
+        bracket(x, stride, width, x0, x1, fx);
+        bracket(y, stride, height, y0, y1, fy);
+        const float* c00 = image.pixel(x0, y0);
+        const float* c10 = image.pixel(x1, y0);
+        const float* c01 = image.pixel(x0, y1);
+        const float* c11 = image.pixel(x1, y1);
+        float* out = image.pixel(x, y);
+        for (int c = 0; c < 3; ++c) {
+            float top = c00[c] + (c10[c] - c00[c]) * fx;
+            float bottom = c01[c] + (c11[c] - c01[c]) * fx;
+            out[c] = top + (bottom - top) * fy;
         }
-        
-        return transmittance;
     }
-};
-
-void saveToPPM(const std::string& filename, const std::vector<Vec3>& pixels, int width, int height) {
-    std::ofstream file(filename, std::ios::binary);
-    file << "P6\n" << width << " " << height << "\n255\n";
     
-    for (const auto& color : pixels) {
-        unsigned char r = static_cast<unsigned char>(std::min(color.x * 255.0f, 255.0f));
-        unsigned char g = static_cast<unsigned char>(std::min(color.y * 255.0f, 255.0f));
-        unsigned char b = static_cast<unsigned char>(std::min(color.z * 255.0f, 255.0f));
-        file.write(reinterpret_cast<const char*>(&r), 1);
-        file.write(reinterpret_cast<const char*>(&g), 1);
-        file.write(reinterpret_cast<const char*>(&b), 1);
+    // Interpolate every pixel off the `stride` lattice from its corners
+    void fill(int stride) {
+        if (stride <= 1) return;
+        tbb::parallel_for(tbb::blocked_range<int>(0, height), [&](const tbb::blocked_range<int>& rows) {
+            for (int y = rows.begin(); y != rows.end(); ++y) {
+                for (int x = 0; x < width; ++x) {
+                    if (x % stride != 0 || y % stride != 0) interpolate(x, y, stride);
+                }
+            }
+        });
     }
-}
+    
+    // New lattice points at stride / 2 that need tracing: those in blocks
+    // whose corners differ by more than the threshold, and those past the
+    // last lattice point where there is no block to interpolate. The rest
+    // are interpolated here.
+    std::vector<int> refine(int stride) {
+        const int half = stride / 2;
+        const int lastX = (width - 1) / stride * stride;
+        const int lastY = (height - 1) / stride * stride;
+        std::vector<int> pixels;
+        for (int y = 0; y < height; y += half) {
+            for (int x = 0; x < width; x += half) {
+                if (x % stride == 0 && y % stride == 0) continue;
+                if (x > lastX || y > lastY || contrast(x, y, stride) > options.previewThreshold) {
+                    pixels.push_back(y * width + x);
+                } else {
+                    interpolate(x, y, stride);
+                }
+            }
+        }
+        return pixels;
+    }
+    
+    // Largest per-channel spread of the four corners of the block holding (x, y)
+    float contrast(int x, int y, int stride) const {
+        int x0, x1, y0, y1;
+        float fx, fy;
+        bracket(x, stride, width, x0, x1, fx);
+        bracket(y, stride, height, y0, y1, fy);
+        const float* corners[4] = {image.pixel(x0, y0), image.pixel(x1, y0), image.pixel(x0, y1), image.pixel(x1, y1)};
+        float spread = 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            float lo = corners[0][c], hi = corners[0][c];
+            for (const float* corner : corners) {
+                lo = std::min(lo, corner[c]);
+                hi = std::max(hi, corner[c]);
+            }
+            spread = std::max(spread, hi - lo);
+        }
+        return spread;
+    }
+    
+    // Trace pixels in batches, saving whenever the interval has passed
+    void trace(const std::vector<int>& pixels) {
+        const size_t batchSize = 16384;
+        for (size_t begin = 0; begin < pixels.size(); begin += batchSize) {
+            traceBatch(pixels, begin, std::min(begin + batchSize, pixels.size()));
+            
+            std::chrono::duration<float> sinceSave = Clock::now() - lastSave;
+            if (sinceSave.count() >= options.previewInterval) {
+                saveImage();
+            }
+        }
+    }
+    
+    void traceBatch(const std::vector<int>& pixels, size_t begin, size_t end) {
+        tbb::parallel_for(tbb::blocked_range<size_t>(begin, end, 64), [&](const tbb::blocked_range<size_t>& range) {
+            RenderContext& ctx = contexts.local();
+            for (size_t i = range.begin(); i != range.end(); ++i) {
+                int x = pixels[i] % width;
+                int y = pixels[i] / width;
+                float u = (x + 0.5f) / width;
+                float v = 1.0f - (y + 0.5f) / height;  // Rows run top to bottom
+                
+                Vec3 color = renderer.trace(camera.getRay(u, v), ctx);
+                float* out = image.pixel(x, y);
+                out[0] = color.x;
+                out[1] = color.y;
+                out[2] = color.z;
+            }
+        });
+    }
+    
+    // Write to a sibling file and rename over the output, so a viewer
+    // watching it never reads a partial image
+    void saveImage() {
+        std::filesystem::path path(output);
+        std::filesystem::path partial = path.parent_path() / (path.stem().string() + ".partial" + path.extension().string());
+        if (image.save(partial.string())) {
+            std::error_code error;
+            std::filesystem::rename(partial, path, error);
+            if (error) {
+                std::cerr << "Error: Could not replace " << output << ": " << error.message() << std::endl;
+            }
+        }
+        lastSave = Clock::now();
+    }
+    
+    void save(const char* stage, Clock::time_point start) {
+        saveImage();
+        double ms = std::chrono::duration<double, std::milli>(lastSave - start).count();
+        std::cout << stage << " saved to " << output << " after " << std::fixed << std::setprecision(0)
+                  << ms << " ms" << std::endl;
+    }
+};
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cout << "Usage: " << argv[0] << " <vdb_file>" << std::endl;
+    RenderOptions options;
+    if (!parseArguments(argc, argv, options)) {
+        printUsage(argv[0]);
         return 1;
     }
     
@@ -182,51 +845,217 @@ int main(int argc, char** argv) {
     openvdb::initialize();
     
     try {
-        // Load VDB file
-        openvdb::io::File file(argv[1]);
-        file.open();
-        
-        // Get density grid
-        openvdb::GridBase::Ptr baseGrid = file.readGrid("density");
-        openvdb::FloatGrid::Ptr densityGrid = openvdb::gridPtrCast<openvdb::FloatGrid>(baseGrid);
-        
         // Set up camera
         Vec3 cameraPos(5.0f, 3.0f, 5.0f);
         Vec3 lookAt(0.0f, 0.0f, 0.0f);
         float fov = 60.0f;
-        int width = 800;
-        int height = 600;
+        int width = options.width;
+        int height = options.height;
         float aspect = static_cast<float>(width) / height;
         
         Camera camera(cameraPos, lookAt, Vec3(0,1,0), fov, aspect);
+        Vec3 lightDir(-1.0f, 1.0f, -1.0f);
+        
+        auto inputPath = [&](int frame) {
+            return options.sequence ? framePath(options.vdbFile, frame) : options.vdbFile;
+        };
+        // Crops are named by their top-left pixel, e.g. volume_render.0001.crop_0_300.ppm
+        auto imagePath = [&](const char* stem, int frame, const Tile* crop, const std::string& extension) {
+            std::string path = options.sequence ? framePath(std::string(stem) + ".%04d", frame) : stem;
+            if (crop) {
+                path += ".crop_" + std::to_string(crop->x0) + "_" + std::to_string(crop->y0);
+            }
+            return path + extension;
+        };
+        auto outputPath = [&](int frame, const Tile* crop = nullptr) {
+            return imagePath("volume_render", frame, crop, options.exr ? ".exr" : ".ppm");
+        };
+        auto costPath = [&](int frame, const Tile* crop = nullptr) {
+            return imagePath("volume_render_cost", frame, crop, ".ppm");
+        };
+        
+        // Load the first frame
+        FrameGrids frame = loadFrame(inputPath(options.firstFrame), options, camera, lightDir, false);
         
         // Set up renderer
-        Vec3 lightDir(-1.0f, 1.0f, -1.0f);
-        VolumeRenderer renderer(densityGrid, lightDir, 0.1f);
+        VolumeRenderer renderer(frame.density, lightDir, options.stepSize);
+        renderer.setEmissionGrids(frame.temperature, frame.flame);
+        renderer.setEmissionScale(options.temperatureScale, options.emissionScale);
+        auto mb = [](double bytes) { return bytes / (1024.0 * 1024.0); };
+        if (frame.densityBricks) {
+            // Topology as left after the emission union in setEmissionGrids()
+            renderer.setBrickPool(frame.densityBricks);
+            std::cout << "Quantized density to " << options.quantizeBits << " bits: " << std::fixed
+                      << std::setprecision(1) << mb(frame.floatDensityBytes) << " MB of float voxels became "
+                      << mb(frame.densityBricks->memUsage()) << " MB of bricks and "
+                      << mb(frame.density->memUsage()) << " MB of topology" << std::endl;
+        } else if (options.bricks) {
+            auto start = std::chrono::steady_clock::now();
+            renderer.setBrickPool(true);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            const BrickPool& pool = *renderer.getBrickPool();
+            std::cout << "Brick pool: " << pool.brickCount() << " bricks, "
+                      << std::fixed << std::setprecision(1) << mb(pool.memUsage()) << " MB, built in "
+                      << ms << " ms" << std::endl;
+        }
+        renderer.setSamplerMode(options.samplerMode);
+        renderer.setStepMode(options.stepMode);
+        renderer.setIntegrator(options.integrator);
+        renderer.setPhaseFunction(options.phaseG != 0.0f ? PhaseFunction::HenyeyGreenstein : PhaseFunction::Isotropic,
+                                  options.phaseG);
+        renderer.setTermination(options.primaryThreshold, options.shadowThreshold, options.russianRoulette);
+        renderer.setTraversalMode(options.traversalMode);
+        if (!options.preview) {
+            renderer.setShadowMode(options.shadowMode, options.shadowCacheDownsample);
+        }
+        renderer.setLightCacheReuse(options.shadowReuse, options.shadowReuseTolerance);
+        
+        float footprint = camera.footprintPerDistance(height) * options.lodBias;
+        renderer.setMipLevels(frame.densityLevels, footprint);
+        if (options.lodLevels > 0 && frame.temperature) {
+            std::cerr << "Level of detail covers density only; disabled while rendering emission" << std::endl;
+        }
         
-        // Set up random number generator
+        // Seed for the per-thread random streams
         std::random_device rd;
-        std::mt19937 rng(rd());
+        uint32_t seed = rd();
         
-        // Render image
-        std::vector<Vec3> pixels(width * height);
+        if (options.scalingBenchmark) {
+            runScalingBenchmark(renderer, camera, width, height, seed, options.tileSize, options.packets);
+            return 0;
+        }
         
-        #pragma omp parallel for collapse(2)
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                float u = (x + 0.5f) / width;
-                float v = (y + 0.5f) / height;
-                
-                Ray ray = camera.getRay(u, v);
-                pixels[y * width + x] = renderer.trace(ray, rng);
+        // Contexts, pixel buffers and the renderer itself live across frames
+        std::atomic<uint32_t> nextStream{0};
+        ContextPool contexts([&] {
+            return renderer.makeContext(seed, nextStream++);
+        });
+        
+        if (options.preview) {
+            // The coarse pass's light cache is baked here instead of the final one
+            Image pixels(width, height);
+            PreviewRefiner refiner(renderer, camera, pixels, contexts, options, outputPath(options.firstFrame));
+            refiner.usePreviewQuality();
+            refiner.run();
+            return 0;
+        }
+        
+        // Final frames march on the GPU when built with VOLUME_RENDER_CUDA, a
+        // device is present and it implements every setting; otherwise, and
+        // whenever the GPU fails, they render on the CPU
+        GpuRenderer gpu;
+        bool useGpu = false;
+        std::string device;
+        if (GpuRenderer::available(device)) {
+            const char* missing = options.stats || options.costMap ? "render counters" : GpuRenderer::unsupported(renderer);
+            if (missing) {
+                std::cout << "GPU " << device << " does not support " << missing << "; rendering on the CPU" << std::endl;
+            } else if (gpu.setGrid(*frame.density)) {
+                useGpu = true;
+                std::cout << "Rendering on the GPU: " << device << std::endl;
+            } else {
+                std::cerr << "Could not upload the density to the GPU; rendering on the CPU" << std::endl;
             }
         }
         
-        // Save image
-        saveToPPM("volume_render.ppm", pixels, width, height);
-        std::cout << "Rendered image saved to volume_render.ppm" << std::endl;
+        // One set of buffers per crop window, or one for the whole frame
+        struct CropTarget {
+            Tile window;
+            bool cropped;
+            Image pixels, passPixels, cost;
+        };
+        std::vector<CropTarget> targets;
+        for (const Tile& crop : options.crops) {
+            int cropWidth = crop.x1 - crop.x0, cropHeight = crop.y1 - crop.y0;
+            targets.push_back({crop, true, Image(cropWidth, cropHeight), Image(cropWidth, cropHeight),
+                               Image(cropWidth, cropHeight, 1)});
+        }
+        if (targets.empty()) {
+            targets.push_back({Tile{0, 0, width, height}, false, Image(width, height), Image(width, height),
+                               Image(width, height, 1)});
+        }
         
-        file.close();
+        for (int f = options.firstFrame; f <= options.lastFrame; ++f) {
+            // Read the next frame on an I/O thread while this one renders
+            std::future<FrameGrids> nextFrame;
+            if (f < options.lastFrame) {
+                nextFrame = std::async(std::launch::async, loadFrame, inputPath(f + 1), std::cref(options),
+                                       std::cref(camera), lightDir, true);
+            }
+            
+            for (CropTarget& target : targets) {
+                Image& pixels = target.pixels;
+                Image& cost = target.cost;
+                const Tile* crop = target.cropped ? &target.window : nullptr;
+                CropInfo placement{target.window.x0, target.window.y0, width, height};
+                const CropInfo* cropInfo = target.cropped ? &placement : nullptr;
+                const size_t pixelCount = static_cast<size_t>(pixels.getWidth()) * pixels.getHeight();
+                
+                // Render one pass per sample, keeping the running mean
+                std::string output = outputPath(f, crop);
+                pixels.fill(0.0, 0.0, 0.0);
+                std::fill(cost.data(), cost.data() + pixelCount, 0.0f);
+                collectStats(contexts);
+                for (int pass = 0; pass < options.samplesPerPixel; ++pass) {
+                    if (useGpu && !gpu.renderRegion(renderer, camera, width, height, target.window, target.passPixels)) {
+                        std::cerr << "GPU render failed; continuing on the CPU" << std::endl;
+                        useGpu = false;
+                    }
+                    if (!useGpu) {
+                        renderRegion(renderer, camera, width, height, target.window, target.passPixels, contexts,
+                                     options.tileSize, options.packets, options.costMap ? &cost : nullptr);
+                    }
+                    
+                    float weight = 1.0f / (pass + 1);
+                    float* mean = pixels.data();
+                    const float* sample = target.passPixels.data();
+                    const size_t n = pixelCount * 3;
+                    #pragma omp simd
+                    for (size_t i = 0; i < n; ++i) {
+                        mean[i] += (sample[i] - mean[i]) * weight;
+                    }
+                    
+                    if (options.progressive && pass + 1 < options.samplesPerPixel) {
+                        pixels.save(output, cropInfo);
+                        std::cout << "Pass " << (pass + 1) << "/" << options.samplesPerPixel << " saved" << std::endl;
+                    }
+                }
+                
+                // Save image
+                pixels.save(output, cropInfo);
+                std::cout << "Rendered image saved to " << output << std::endl;
+                if (options.stats) {
+                    printStats(collectStats(contexts));
+                }
+                if (options.costMap) {
+                    float maxCost = *std::max_element(cost.data(), cost.data() + pixelCount);
+                    costHeatmap(cost).savePPM(costPath(f, crop), cropInfo);
+                    std::cout << "Cost heatmap saved to " << costPath(f, crop) << " (white = " << maxCost
+                              << " samples per pixel)" << std::endl;
+                }
+            }
+            
+            if (nextFrame.valid()) {
+                frame = nextFrame.get();
+                renderer.setGrids(frame.density, frame.temperature, frame.flame, frame.densityBricks);
+                renderer.setMipLevels(frame.densityLevels, footprint);
+                if (useGpu && !gpu.setGrid(*frame.density)) {
+                    std::cerr << "Could not upload frame " << (f + 1) << " to the GPU; continuing on the CPU" << std::endl;
+                    useGpu = false;
+                }
+                const LightCacheUpdate& update = renderer.getLightCacheUpdate();
+                if (options.shadowReuse && update.incremental) {
+                    size_t voxels = update.marchedVoxels + update.reusedVoxels;
+                    std::cout << "Light cache updated for frame " << (f + 1) << ": " << update.changedRegions
+                              << " changed leaves and tiles, " << update.marchedVoxels << " of " << voxels
+                              << " voxels marched in " << std::fixed << std::setprecision(1)
+                              << update.seconds * 1000.0 << " ms" << std::endl;
+                }
+                for (RenderContext& ctx : contexts) {
+                    renderer.rebindContext(ctx);
+                }
+            }
+        }
     }
     catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;